@@ -4,10 +4,95 @@
 
 // CAN interface
 static const int MCP2515_CS_PIN  = 5;
+// Set to the pin the MCP2515 INT output is connected to (2 or 3 on the Nano) to
+// receive frames interrupt-driven. With 255 (not connected) the MCP2515 is polled.
 static const int MCP2515_INT_PIN = 255;
 static const uint32_t CAN_QUARTZ_FREQUENCY = 8UL * 1000UL * 1000UL ; // 8 MHz
 static bool canAvailable = false;
 
+/*
+ * Binary CAN frame record exchanged with the gateway, if requested with
+ * "SETUP <bitrate> <mode> BIN[ D<batch delay ms>]". Otherwise the text format is used.
+ *
+ * The ID uses the same flag bits as the text format (bit 31 = extended, bit 30 = RTR)
+ * and is transferred in little endian byte order (native on both the AVR and ESP8266).
+ * Received frames carry the micros() timestamp of when they were taken from the MCP2515.
+ * Frames to be sent carry a sequence tag in the timestamp field instead, which is
+ * echoed in the reply ("CANTX OK|ESEND|ENOAV|ENVAL <tag hex>"). Text frames are untagged.
+ *
+ * If a batch delay is requested, received frames are packed into batches:
+ * [CAN_FRAME_BATCH_RX][count][CanFrameData x count]. A batch is flushed when it is
+ * full or when its first frame has waited for the batch delay.
+ *
+ * With " F<mask 0>,<mask 1>,<filter 0>,...,<filter 5>" (hex) appended to the SETUP
+ * message, the MCP2515 only accepts the matching standard frames (mask 0 applies to
+ * filters 0-1, mask 1 to filters 2-5). The hits per filter are then reported
+ * periodically with "FILTER <hits 0> ... <hits 5>".
+ *
+ * Received frames are moved from the CAN driver into a RAM ring buffer right in the
+ * interrupt handler (or in the loop if the MCP2515 is polled) and timestamped there,
+ * so they survive stalls of the loop and the serial connection. Its fill level is
+ * reported periodically with "STATS <size> <high water> <overflows> <driver peak> <driver size>".
+ *
+ * NOTE: this must be kept in sync with SerialCan.h of the wifi-gateway!
+ */
+static const uint8_t CAN_FRAME_RECORD_RX = 0x01u;
+static const uint8_t CAN_FRAME_RECORD_TX = 0x02u;
+static const uint8_t CAN_FRAME_BATCH_RX = 0x03u;
+
+static const uint32_t CAN_FRAME_ID_MASK = 0x1FFFFFFFu;
+static const uint32_t CAN_FRAME_EXT_FLAG = 0x80000000u;
+static const uint32_t CAN_FRAME_RTR_FLAG = 0x40000000u;
+
+struct __attribute__((__packed__)) CanFrameData {
+  uint32_t id;
+  uint8_t len;
+  uint8_t data[8];
+  uint32_t timestampUs;
+};
+
+struct __attribute__((__packed__)) CanFrameRecord {
+  uint8_t type;
+  CanFrameData frame;
+};
+
+static_assert(sizeof(CanFrameRecord) == 18, "CanFrameRecord must be packed");
+
+static const uint8_t CAN_RX_BATCH_MAX_FRAMES = 3;
+static const uint8_t CAN_RX_BATCH_HEADER_SIZE = 2;
+
+static const uint8_t CAN_ACCEPTANCE_FILTER_COUNT = 6;
+static const unsigned long FILTER_REPORT_INTERVAL_MS = 10000;
+
+// The RX ring buffer takes whatever SRAM is left after setup(), except for a
+// reserve for the stack and the buffers of the CAN driver (16 bytes per frame).
+static const uint8_t CAN_RX_RING_MAX_FRAMES = 64;
+static const uint8_t CAN_RX_RING_MIN_FRAMES = 8;
+static const uint8_t CAN_DRIVER_RECEIVE_BUFFER_SIZE = 8;
+static const uint8_t CAN_DRIVER_TRANSMIT_BUFFER_SIZE = 8;
+static const size_t SRAM_RESERVE_BYTES = 256 + (CAN_DRIVER_RECEIVE_BUFFER_SIZE + CAN_DRIVER_TRANSMIT_BUFFER_SIZE) * 16;
+static const unsigned long STATS_REPORT_INTERVAL_MS = 10000;
+
+bool binaryFrames = false;
+bool rxBatching = false;
+uint16_t rxBatchDelayMs = 0;
+uint8_t rxBatch[CAN_RX_BATCH_HEADER_SIZE + CAN_RX_BATCH_MAX_FRAMES * sizeof(CanFrameData)];
+uint8_t rxBatchCount = 0;
+unsigned long rxBatchStartMs = 0;
+bool acceptanceFilter = false;
+uint16_t acceptanceMasks[2];
+uint16_t acceptanceFilters[CAN_ACCEPTANCE_FILTER_COUNT];
+volatile uint32_t filterHits[CAN_ACCEPTANCE_FILTER_COUNT]; // counted in the interrupt handler
+unsigned long filterReportMs = 0;
+// The RX ring is filled by the interrupt handler, the loop only takes frames from its head
+CanFrameData* rxRing = NULL;
+uint8_t rxRingSize = 0;
+volatile uint8_t rxRingHead = 0;
+volatile uint8_t rxRingCount = 0;
+volatile uint8_t rxRingHighWater = 0;
+volatile uint32_t rxRingOverflows = 0;
+volatile bool rxRingFilling = false;
+unsigned long statsReportMs = 0;
 bool doCanSetup = false; // Flag to defer CAN setup to main loop
 uint32_t canBitRate = 20000ul;
 ACAN2515Settings::RequestedMode canMode = ACAN2515Settings::ListenOnlyMode;
@@ -32,14 +117,38 @@ void teardownCan() {
   _ledToggleInterval = 500;
 }
 
+void canInterrupt() {
+  can.isr();
+  fillCanRxRing();
+}
+
 void setupCan() {
   teardownCan();
 
   ACAN2515Settings settings (CAN_QUARTZ_FREQUENCY, canBitRate);
   settings.mRequestedMode = canMode;
-  settings.mReceiveBufferSize = 16;
-  settings.mTransmitBuffer0Size = 8;
-  const uint16_t errorCode = can.begin(settings, NULL);
+  settings.mReceiveBufferSize = CAN_DRIVER_RECEIVE_BUFFER_SIZE;
+  settings.mTransmitBuffer0Size = CAN_DRIVER_TRANSMIT_BUFFER_SIZE;
+  void (*isr)() = MCP2515_INT_PIN == 255 ? NULL : canInterrupt;
+  memset((void*)filterHits, 0, sizeof(filterHits));
+  filterReportMs = millis();
+  resetCanRxRing();
+  uint16_t errorCode;
+  if (acceptanceFilter) {
+    const ACAN2515Mask rxm0 = standard2515Mask(acceptanceMasks[0], 0, 0);
+    const ACAN2515Mask rxm1 = standard2515Mask(acceptanceMasks[1], 0, 0);
+    const ACAN2515AcceptanceFilter filters[CAN_ACCEPTANCE_FILTER_COUNT] = {
+      {standard2515Filter(acceptanceFilters[0], 0, 0), NULL},
+      {standard2515Filter(acceptanceFilters[1], 0, 0), NULL},
+      {standard2515Filter(acceptanceFilters[2], 0, 0), NULL},
+      {standard2515Filter(acceptanceFilters[3], 0, 0), NULL},
+      {standard2515Filter(acceptanceFilters[4], 0, 0), NULL},
+      {standard2515Filter(acceptanceFilters[5], 0, 0), NULL},
+    };
+    errorCode = can.begin(settings, isr, rxm0, rxm1, filters, CAN_ACCEPTANCE_FILTER_COUNT);
+  } else {
+    errorCode = can.begin(settings, isr);
+  }
   canAvailable = errorCode == 0;
 
   if (canAvailable) {
@@ -63,7 +172,196 @@ void setupCan() {
   }
 }
 
-void processReceived(const char* message, serial_transport::Endpoint& serial) {
+/**
+ * Reply to a frame to be sent, echoing its sequence tag (if it has one).
+ */
+void queueCanTxReply(toolbox::strref result, uint8_t tag) {
+  if (tag == 0) {
+    serial.queue(toolbox::format(F("CANTX %s"), result.ref()));
+  } else {
+    serial.queue(toolbox::format(F("CANTX %s %02X"), result.ref(), tag));
+  }
+}
+
+void sendCanFrame(const CANMessage& frame, uint8_t tag) {
+  if (canAvailable) {
+    if (can.tryToSend(frame)) {
+      queueCanTxReply(F("OK"), tag);
+    } else {
+      queueCanTxReply(F("ESEND"), tag);
+    }
+  } else {
+    queueCanTxReply(F("ENOAV"), tag);
+  }
+}
+
+void processReceivedRecord(const uint8_t* payload) {
+  CanFrameRecord record;
+  memcpy(&record, payload, sizeof(record));
+
+  uint8_t tag = record.frame.timestampUs & 0xFFu; // TX records carry the sequence tag instead of a timestamp
+
+  if (record.frame.len > 8) {
+    queueCanTxReply(F("ENVAL"), tag);
+    return;
+  }
+
+  CANMessage frame;
+  frame.id = record.frame.id & CAN_FRAME_ID_MASK;
+  frame.ext = (record.frame.id & CAN_FRAME_EXT_FLAG) != 0;
+  frame.rtr = (record.frame.id & CAN_FRAME_RTR_FLAG) != 0;
+  frame.len = record.frame.len;
+  memcpy(frame.data, record.frame.data, 8);
+
+  sendCanFrame(frame, tag);
+}
+
+void encodeCanFrameData(const CANMessage& frame, uint32_t timestampUs, CanFrameData& data) {
+  data.id = (frame.id & CAN_FRAME_ID_MASK) | (frame.ext ? CAN_FRAME_EXT_FLAG : 0ul) | (frame.rtr ? CAN_FRAME_RTR_FLAG : 0ul);
+  data.len = frame.len;
+  memcpy(data.data, frame.data, 8);
+  data.timestampUs = timestampUs;
+}
+
+void queueCanRxRecord(const CanFrameData& data) {
+  CanFrameRecord record;
+  record.type = CAN_FRAME_RECORD_RX;
+  record.frame = data;
+  serial.queue(reinterpret_cast<const uint8_t*>(&record), sizeof(record));
+}
+
+void queueCanRxText(const CanFrameData& data) {
+  queueCanRxMessage(serial, data.id & CAN_FRAME_ID_MASK, (data.id & CAN_FRAME_EXT_FLAG) != 0, (data.id & CAN_FRAME_RTR_FLAG) != 0, data.len, data.data);
+}
+
+void addToCanRxBatch(const CanFrameData& data) {
+  if (rxBatchCount == 0) {
+    rxBatchStartMs = millis();
+  }
+
+  memcpy(rxBatch + CAN_RX_BATCH_HEADER_SIZE + rxBatchCount * sizeof(CanFrameData), &data, sizeof(CanFrameData));
+  rxBatchCount += 1;
+}
+
+void flushCanRxBatch() {
+  rxBatch[0] = CAN_FRAME_BATCH_RX;
+  rxBatch[1] = rxBatchCount;
+  serial.queue(rxBatch, CAN_RX_BATCH_HEADER_SIZE + rxBatchCount * sizeof(CanFrameData));
+  rxBatchCount = 0;
+}
+
+void resetCanRxBatch() {
+  rxBatching = false;
+  rxBatchCount = 0;
+}
+
+size_t freeMemory() {
+  extern char* __brkval;
+  extern char __heap_start;
+  char top;
+  return &top - (__brkval != NULL ? __brkval : &__heap_start);
+}
+
+void allocateCanRxRing() {
+  size_t available = freeMemory();
+  size_t frames = available > SRAM_RESERVE_BYTES ? (available - SRAM_RESERVE_BYTES) / sizeof(CanFrameData) : 0;
+  rxRingSize = max(CAN_RX_RING_MIN_FRAMES, (uint8_t)min(frames, (size_t)CAN_RX_RING_MAX_FRAMES));
+  rxRing = static_cast<CanFrameData*>(malloc(rxRingSize * sizeof(CanFrameData)));
+  if (rxRing == NULL) {
+    rxRingSize = 0;
+  }
+}
+
+void resetCanRxRing() {
+  rxRingHead = 0;
+  rxRingCount = 0;
+  rxRingHighWater = 0;
+  rxRingOverflows = 0;
+  statsReportMs = millis();
+}
+
+/**
+ * Move all frames received by the CAN driver into the RX ring buffer. If the ring
+ * is full, the newest frames are dropped and counted as overflows.
+ *
+ * This is called from the interrupt handler and from the loop. As the driver
+ * enables interrupts again when taking a frame, a nested call may happen while
+ * the ring is being filled: it leaves the frame to the call already filling it.
+ */
+void fillCanRxRing() {
+  if (rxRingFilling) {
+    return;
+  }
+  rxRingFilling = true;
+  CANMessage frame;
+  while (can.receive(frame)) {
+    countFilterHit(frame);
+    if (rxRingCount == rxRingSize) {
+      rxRingOverflows += 1;
+      continue;
+    }
+    encodeCanFrameData(frame, micros(), rxRing[(rxRingHead + rxRingCount) % rxRingSize]);
+    rxRingCount += 1;
+    if (rxRingCount > rxRingHighWater) {
+      rxRingHighWater = rxRingCount;
+    }
+  }
+  rxRingFilling = false;
+}
+
+const CanFrameData& frontCanRxRing() {
+  return rxRing[rxRingHead];
+}
+
+void popCanRxRing() {
+  noInterrupts();
+  rxRingHead = (rxRingHead + 1) % rxRingSize;
+  rxRingCount -= 1;
+  interrupts();
+}
+
+void reportStats() {
+  if (millis() - statsReportMs < STATS_REPORT_INTERVAL_MS || !serial.canQueue()) {
+    return;
+  }
+  statsReportMs = millis();
+  noInterrupts();
+  uint8_t highWater = rxRingHighWater;
+  uint32_t overflows = rxRingOverflows;
+  interrupts();
+  serial.queue(toolbox::format(F("STATS %u %u %lu %u %u"),
+    rxRingSize, highWater, (unsigned long)overflows, can.receiveBufferPeakCount(), can.receiveBufferSize()));
+}
+
+void countFilterHit(const CANMessage& frame) {
+  if (acceptanceFilter && frame.idx < CAN_ACCEPTANCE_FILTER_COUNT) {
+    filterHits[frame.idx] += 1;
+  }
+}
+
+void reportFilterHits() {
+  if (!acceptanceFilter || millis() - filterReportMs < FILTER_REPORT_INTERVAL_MS || !serial.canQueue()) {
+    return;
+  }
+  filterReportMs = millis();
+  uint32_t hits[CAN_ACCEPTANCE_FILTER_COUNT];
+  noInterrupts();
+  for (uint8_t i = 0; i < CAN_ACCEPTANCE_FILTER_COUNT; ++i) {
+    hits[i] = filterHits[i];
+  }
+  interrupts();
+  serial.queue(toolbox::format(F("FILTER %lu %lu %lu %lu %lu %lu"),
+    (unsigned long)hits[0], (unsigned long)hits[1], (unsigned long)hits[2],
+    (unsigned long)hits[3], (unsigned long)hits[4], (unsigned long)hits[5]));
+}
+
+void processReceived(const uint8_t* payload, uint8_t payloadLen, serial_transport::Endpoint& serial) {
+  if (payloadLen == sizeof(CanFrameRecord) && payload[0] == CAN_FRAME_RECORD_TX) {
+    processReceivedRecord(payload);
+    return;
+  }
+
+  const char* message = reinterpret_cast<const char*>(payload);
   const char* start = message;
   char* end = nullptr;
 
@@ -76,21 +374,76 @@ void processReceived(const char* message, serial_transport::Endpoint& serial) {
     start = end;
 
     ACAN2515Settings::RequestedMode newCanMode = ACAN2515Settings::NormalMode;
-    if (strcmp(start, " NOR") == 0) {
+    if (strncmp(start, " NOR", 4) == 0) {
       newCanMode = ACAN2515Settings::NormalMode;
-    } else if (strcmp(start, " LOP") == 0) {
+    } else if (strncmp(start, " LOP", 4) == 0) {
       newCanMode = ACAN2515Settings::LoopBackMode;
-    } else if (strcmp(start, " SLP") == 0) {
+    } else if (strncmp(start, " SLP", 4) == 0) {
       newCanMode = ACAN2515Settings::SleepMode;
-    } else if (strcmp(start, " LIS") == 0) {
+    } else if (strncmp(start, " LIS", 4) == 0) {
       newCanMode = ACAN2515Settings::ListenOnlyMode;
     } else {
       serial.queue(F("SETUP ENVAL"));
       return;
     }
+    start += 4;
+
+    bool newBinaryFrames = false;
+    bool newRxBatching = false;
+    uint16_t newRxBatchDelayMs = 0;
+    if (strncmp(start, " BIN", 4) == 0) {
+      newBinaryFrames = true;
+      start += 4;
+
+      if (strncmp(start, " D", 2) == 0) {
+        newRxBatchDelayMs = strtol(start + 2, &end, 10);
+        if (end == start + 2) {
+          serial.queue(F("SETUP ENVAL"));
+          return;
+        }
+        newRxBatching = true;
+        start = end;
+      }
+    }
+
+    bool newAcceptanceFilter = false;
+    uint16_t newAcceptanceValues[2 + CAN_ACCEPTANCE_FILTER_COUNT];
+    if (strncmp(start, " F", 2) == 0) {
+      start += 2;
+      for (uint8_t i = 0; i < 2 + CAN_ACCEPTANCE_FILTER_COUNT; ++i) {
+        if (i > 0) {
+          if (*start != ',') {
+            serial.queue(F("SETUP ENVAL"));
+            return;
+          }
+          start += 1;
+        }
+        newAcceptanceValues[i] = strtol(start, &end, 16);
+        if (end == start) {
+          serial.queue(F("SETUP ENVAL"));
+          return;
+        }
+        start = end;
+      }
+      newAcceptanceFilter = true;
+    }
+
+    if (*start != '\0') {
+      serial.queue(F("SETUP ENVAL"));
+      return;
+    }
 
     canBitRate = bitrate;
     canMode = newCanMode;
+    binaryFrames = newBinaryFrames;
+    resetCanRxBatch();
+    rxBatching = newRxBatching;
+    rxBatchDelayMs = newRxBatchDelayMs;
+    acceptanceFilter = newAcceptanceFilter;
+    if (acceptanceFilter) {
+      memcpy(acceptanceMasks, newAcceptanceValues, sizeof(acceptanceMasks));
+      memcpy(acceptanceFilters, newAcceptanceValues + 2, sizeof(acceptanceFilters));
+    }
 
     doCanSetup = true; // Trigger CAN setup in main loop
   } else if (strncmp(start, "CANTX ", 6) == 0) {
@@ -128,13 +481,7 @@ void processReceived(const char* message, serial_transport::Endpoint& serial) {
       start = end;
     }
 
-    if (can.tryToSend(frame)) {
-      serial.queue(F("CANTX OK"));
-      return;
-    } else {
-      serial.queue(F("CANTX ESEND"));
-      return;
-    }
+    sendCanFrame(frame, 0);
   } else {
     serial.queue(F("ERROR UNK"));
     return;
@@ -143,9 +490,12 @@ void processReceived(const char* message, serial_transport::Endpoint& serial) {
 
 void connectionStateChanged(serial_transport::ConnectionState state, serial_transport::Endpoint& serial) {
   if (state == serial_transport::ConnectionState::CONNECTED) {
-    serial.queue(F("READY"));
+    serial.queue(F("READY BIN FLT"));
   } else {
     teardownCan();
+    binaryFrames = false;
+    acceptanceFilter = false;
+    resetCanRxBatch();
   }
 }
 
@@ -185,6 +535,8 @@ void setup() {
 
   SPI.begin();
 
+  allocateCanRxRing();
+
   digitalWrite(HEARTBEAT_LED_PIN, LOW);
 }
 
@@ -197,12 +549,35 @@ void loop() {
   }
     
   if (canAvailable) {
-    can.poll();
+    if (MCP2515_INT_PIN == 255) {
+      can.poll();
+    }
 
-    CANMessage frame;
-    while (serial.canQueue() && can.receive(frame)) {
-      queueCanRxMessage(serial, frame.id, frame.ext, frame.rtr, frame.len, frame.data);
+    fillCanRxRing(); // picks up frames left by a nested interrupt (and the only way if polled)
+
+    if (rxBatching) {
+      while (rxBatchCount < CAN_RX_BATCH_MAX_FRAMES && rxRingCount > 0) {
+        addToCanRxBatch(frontCanRxRing());
+        popCanRxRing();
+      }
+
+      if (rxBatchCount > 0 && serial.canQueue()
+        && (rxBatchCount == CAN_RX_BATCH_MAX_FRAMES || millis() - rxBatchStartMs >= rxBatchDelayMs)) {
+        flushCanRxBatch();
+      }
+    } else {
+      while (serial.canQueue() && rxRingCount > 0) {
+        if (binaryFrames) {
+          queueCanRxRecord(frontCanRxRing());
+        } else {
+          queueCanRxText(frontCanRxRing());
+        }
+        popCanRxRing();
+      }
     }
+
+    reportFilterHits();
+    reportStats();
   }
 
   if (millis() - _ledToggleTime >= _ledToggleInterval) {
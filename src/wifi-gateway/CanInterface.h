@@ -4,6 +4,8 @@
 #include <cstdint>
 #include <cstring>
 #include <algorithm>
+#include <vector>
+#include <functional>
 #include <toolbox/String.h>
 #include "OperationResult.h"
 
@@ -13,14 +15,15 @@ struct CanMessage {
   bool rtr;
   uint8_t len;
   uint8_t data[8];
+  unsigned long timestampMs; // millis() at which the message was received from the bus (0 for messages to be sent)
 
   CanMessage()
-  : id(0), ext(false), rtr(false), len(0) {
+  : id(0), ext(false), rtr(false), len(0), timestampMs(0) {
     memset(this->data, 0, 8);
   }
 
-  CanMessage(uint32_t id, bool ext, bool rtr, uint8_t len, const uint8_t (&data)[8])
-  : id(id), ext(ext), rtr(rtr), len(len) {
+  CanMessage(uint32_t id, bool ext, bool rtr, uint8_t len, const uint8_t (&data)[8], unsigned long timestampMs = 0)
+  : id(id), ext(ext), rtr(rtr), len(len), timestampMs(timestampMs) {
     memcpy(this->data, data, std::size(data));
   }
 };
@@ -47,6 +50,39 @@ CanMode canModeFromString(toolbox::strref mode) {
   return CanMode::ListenOnly;
 }
 
+/**
+ * Traffic class of a CAN message to be sent. Each class has its own send budget
+ * and the order also defines the priority: queued messages of a class with a
+ * lower number are always sent before messages of classes with higher numbers.
+ */
+enum struct TrafficClass : uint8_t {
+  Write = 0, // Writes to parameters
+  TimeSync = 1, // Date/time requests
+  Registration = 2, // Device registration and responses of our own devices
+  Poll = 3, // Routine requests (e.g. subscription polls)
+  Discovery = 4, // Scanning for available values
+};
+
+static constexpr size_t TRAFFIC_CLASS_COUNT = 5;
+
+toolbox::strref trafficClassToString(TrafficClass trafficClass) {
+  switch (trafficClass) {
+    case TrafficClass::Write: return "Write";
+    case TrafficClass::TimeSync: return "TimeSync";
+    case TrafficClass::Registration: return "Registration";
+    case TrafficClass::Poll: return "Poll";
+    case TrafficClass::Discovery: return "Discovery";
+    default: return "?";
+  }
+}
+
+/**
+ * Called with the outcome of sending a message once the CAN bridge reported it:
+ * true if the message was handed to the CAN controller for transmission, false
+ * if it was rejected, timed out or discarded (e.g. on a reset).
+ */
+using TxCompletionHandler = std::function<void(bool sent)>;
+
 struct CanCounters {
   uint32_t rx = 0;
   uint32_t tx = 0;
@@ -60,8 +96,9 @@ public:
   virtual bool ready() const = 0;
   virtual void onReady(std::function<void()> readyHandler) = 0;
   virtual void onMessage(std::function<void(const CanMessage& message)> messageHandler) = 0;
-  virtual OperationResult sendCanMessage(const CanMessage& message) = 0; // Returns Accepted if queued, RateLimited/NotReady otherwise
-  virtual float getAvailableTokens() const = 0; // Query available send budget (1 token = 1 frame)
+  virtual OperationResult sendCanMessage(const CanMessage& message, TrafficClass trafficClass, TxCompletionHandler completionHandler = nullptr) = 0; // Returns Accepted if queued, QueueFull/NotReady otherwise
+  virtual uint32_t getAvailableTokens(TrafficClass trafficClass) const = 0; // Query available send budget of a traffic class (1 token = 1 frame)
+  virtual void setAcceptedIds(std::vector<uint32_t> const& ids) = 0; // Hint which (standard) IDs are of interest, an empty list accepts all messages
   virtual CanCounters const& counters() const = 0;
 };
 
@@ -0,0 +1,129 @@
+#ifndef CANTRACE_H_
+#define CANTRACE_H_
+
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <new>
+#include "CanInterface.h"
+
+enum struct TraceDirection : uint8_t {
+  Rx = 0,
+  Tx = 1
+};
+
+/**
+ * A single traced CAN frame, packed into 16 bytes.
+ *
+ * The ID uses the same flag bits as the frames exchanged with the bridge
+ * (bit 31 = extended, bit 30 = RTR) plus bit 29 for the direction. The
+ * timestamp is stored with 28 bits (wraps after ~74 hours) to make room
+ * for the length in the upper 4 bits.
+ */
+struct TraceRecord {
+  static constexpr uint32_t ID_MASK = 0x1FFFFFFFu;
+  static constexpr uint32_t EXT_FLAG = 0x80000000u;
+  static constexpr uint32_t RTR_FLAG = 0x40000000u;
+  static constexpr uint32_t TX_FLAG = 0x20000000u;
+  static constexpr uint32_t TIMESTAMP_MASK = 0x0FFFFFFFu;
+  static constexpr uint8_t LEN_BIT_POS = 28u;
+
+  uint32_t id;
+  uint32_t timestampAndLen;
+  uint8_t data[8];
+
+  uint32_t canId() const { return id & ID_MASK; }
+  bool ext() const { return (id & EXT_FLAG) != 0; }
+  bool rtr() const { return (id & RTR_FLAG) != 0; }
+  TraceDirection direction() const { return (id & TX_FLAG) != 0 ? TraceDirection::Tx : TraceDirection::Rx; }
+  uint8_t len() const { return timestampAndLen >> LEN_BIT_POS; }
+  uint32_t timestampMs() const { return timestampAndLen & TIMESTAMP_MASK; }
+
+  /**
+   * Age of the record relative to the given (full) millis() value.
+   */
+  uint32_t ageMs(unsigned long currentMs) const { return (currentMs - timestampMs()) & TIMESTAMP_MASK; }
+};
+
+/**
+ * Fixed-size ring of the most recent CAN frames sent and received.
+ *
+ * Recording a frame only copies 16 bytes, so tracing can stay enabled all
+ * the time. Any formatting is deferred until the trace is read (see CanTraceApi).
+ * The ring is allocated permanently from the heap shared with the data entries
+ * and the history, so its capacity is capped at 8 KB.
+ */
+class CanTrace final {
+public:
+  static constexpr size_t MAX_CAPACITY = 512; // frames
+
+private:
+  TraceRecord* _records = nullptr;
+  size_t _capacity = 0;
+  size_t _next = 0;
+  size_t _size = 0;
+  uint32_t _total = 0;
+
+public:
+  ~CanTrace() {
+    delete[] _records;
+  }
+
+  /**
+   * Change the capacity (0 disables tracing), which discards recorded frames.
+   */
+  bool resize(size_t capacity) {
+    capacity = std::min(capacity, MAX_CAPACITY);
+    if (capacity == _capacity) {
+      return true;
+    }
+    delete[] _records;
+    _records = nullptr;
+    _capacity = 0;
+    if (capacity > 0) {
+      _records = new (std::nothrow) TraceRecord[capacity];
+      if (_records == nullptr) {
+        clear();
+        return false;
+      }
+      _capacity = capacity;
+    }
+    clear();
+    return true;
+  }
+
+  void clear() {
+    _next = 0;
+    _size = 0;
+  }
+
+  void record(TraceDirection direction, CanMessage const& message, unsigned long timestampMs) {
+    if (_capacity == 0) {
+      return;
+    }
+    TraceRecord& record = _records[_next];
+    record.id = (message.id & TraceRecord::ID_MASK)
+      | (message.ext ? TraceRecord::EXT_FLAG : 0u)
+      | (message.rtr ? TraceRecord::RTR_FLAG : 0u)
+      | (direction == TraceDirection::Tx ? TraceRecord::TX_FLAG : 0u);
+    record.timestampAndLen = (static_cast<uint32_t>(std::min<uint8_t>(message.len, 8u)) << TraceRecord::LEN_BIT_POS) | (timestampMs & TraceRecord::TIMESTAMP_MASK);
+    memcpy(record.data, message.data, 8);
+
+    _next = (_next + 1) % _capacity;
+    _size = std::min(_size + 1, _capacity);
+    _total += 1;
+  }
+
+  size_t capacity() const { return _capacity; }
+  size_t size() const { return _size; }
+  uint32_t total() const { return _total; }
+
+  /**
+   * Record by age, from 0 (oldest) to size() - 1 (newest).
+   */
+  TraceRecord const& operator[](size_t index) const {
+    return _records[(_next + _capacity - _size + index) % _capacity];
+  }
+};
+
+#endif
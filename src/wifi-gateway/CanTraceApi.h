@@ -0,0 +1,119 @@
+#ifndef CANTRACEAPI_H_
+#define CANTRACEAPI_H_
+
+#include <iot_core/api/Interfaces.h>
+#include "CanTrace.h"
+#include "StiebelEltronProtocol.h"
+
+static const char ARG_TRACE_FORMAT[] = "format";
+static const char ARG_TRACE_FORMAT_CANDUMP[] = "candump";
+static const char ARG_TRACE_COUNT[] = "count";
+
+/**
+ * Provides the recorded CAN trace, either as text with the decoded protocol
+ * messages or in the log file format of candump (can-utils).
+ */
+class CanTraceApi final : public iot_core::api::IProvider {
+private:
+  iot_core::Logger _logger;
+  iot_core::ISystem& _system;
+  const CanTrace& _trace;
+
+public:
+  CanTraceApi(iot_core::ISystem& system, const CanTrace& trace)
+  : _logger(system.logger("api")), _system(system), _trace(trace) {}
+
+  void setupApi(iot_core::api::IServer& server) override {
+    server.on(F("/api/trace"), iot_core::api::HttpMethod::GET, [this](iot_core::api::IRequest& request, iot_core::api::IResponse& response) {
+      getTrace(request, response);
+    });
+  }
+
+private:
+  void getTrace(iot_core::api::IRequest& request, iot_core::api::IResponse& response) {
+    bool candump = request.hasArg(ARG_TRACE_FORMAT) && request.arg(ARG_TRACE_FORMAT) == ARG_TRACE_FORMAT_CANDUMP;
+    size_t count = _trace.size();
+    if (request.hasArg(ARG_TRACE_COUNT)) {
+      count = std::min<size_t>(count, toolbox::convert<uint16_t>::fromString(request.arg(ARG_TRACE_COUNT), nullptr, 10).otherwise(count));
+    }
+
+    auto& body = response
+      .code(iot_core::api::ResponseCode::Ok)
+      .contentType(iot_core::api::ContentType::TextPlain)
+      .sendChunkedBody();
+
+    if (!body.valid()) {
+      return;
+    }
+
+    unsigned long currentMs = millis();
+    for (size_t i = _trace.size() - count; i < _trace.size(); ++i) {
+      const TraceRecord& record = _trace[i];
+      body.write(candump ? formatCandump(record, currentMs) : formatText(record, currentMs));
+      _system.lyield();
+    }
+  }
+
+  /**
+   * "(<seconds>.<microseconds>) can0 <ID>#<data>", where the time is the uptime.
+   */
+  static const char* formatCandump(const TraceRecord& record, unsigned long currentMs) {
+    static char line[56]; // "(4294967.295000) can0 12345678#FFFFFFFFFFFFFFFF\n"
+    unsigned long timeMs = currentMs - record.ageMs(currentMs);
+    int insertPos = snprintf(line, sizeof(line), record.ext() ? "(%lu.%03lu000) can0 %08X#" : "(%lu.%03lu000) can0 %03X#", timeMs / 1000u, timeMs % 1000u, record.canId());
+    if (record.rtr()) {
+      line[insertPos++] = 'R';
+    } else {
+      for (size_t i = 0; i < record.len(); ++i) {
+        insertPos += snprintf(line + insertPos, sizeof(line) - insertPos, "%02X", record.data[i]);
+      }
+    }
+    line[insertPos++] = '\n';
+    line[insertPos] = '\0';
+    return line;
+  }
+
+  /**
+   * "<uptime ms> RX|TX <ID> <len> <data> <decoded message>"
+   */
+  static const char* formatText(const TraceRecord& record, unsigned long currentMs) {
+    static char line[96]; // "4294967295 RX 12345678xr 8 FFFFFFFFFFFFFFFF RES t:XXX/XXX s:XXX/XXX id:FFFFs v:FFFF\n"
+    unsigned long timeMs = currentMs - record.ageMs(currentMs);
+    int insertPos = snprintf(line, sizeof(line), "%lu %s %X", timeMs, record.direction() == TraceDirection::Tx ? "TX" : "RX", record.canId());
+    if (record.ext()) {
+      line[insertPos++] = 'x';
+    }
+    if (record.rtr()) {
+      line[insertPos++] = 'r';
+    }
+    insertPos += snprintf(line + insertPos, sizeof(line) - insertPos, " %u ", record.len());
+    for (size_t i = 0; i < record.len(); ++i) {
+      insertPos += snprintf(line + insertPos, sizeof(line) - insertPos, "%02X", record.data[i]);
+    }
+
+    if (!record.ext() && !record.rtr() && record.len() == 7) {
+      MessageType type = getMessageType(record.data);
+      DeviceId target = getTargetId(record.data);
+      DeviceId source = fromCanId(record.canId());
+      switch (type) {
+        case MessageType::Write:
+        case MessageType::Response:
+          insertPos += snprintf(line + insertPos, sizeof(line) - insertPos, " %s t:%s s:%s id:%04X%c v:%04X", messageTypeToString(type), target.toString(0), source.toString(1), getValueId(record.data), hasShortValueId(record.data) ? 's' : 'l', getValue(record.data));
+          break;
+        case MessageType::Request:
+          insertPos += snprintf(line + insertPos, sizeof(line) - insertPos, " %s t:%s s:%s id:%04X%c", messageTypeToString(type), target.toString(0), source.toString(1), getValueId(record.data), hasShortValueId(record.data) ? 's' : 'l');
+          break;
+        default:
+          insertPos += snprintf(line + insertPos, sizeof(line) - insertPos, " %s t:%s s:%s", messageTypeToString(type), target.toString(0), source.toString(1));
+          break;
+      }
+    }
+
+    insertPos = std::min<int>(insertPos, sizeof(line) - 2);
+    line[insertPos++] = '\n';
+    line[insertPos] = '\0';
+    return line;
+  }
+};
+
+#endif
@@ -9,31 +9,204 @@
 #include "OperationResult.h"
 #include "StiebelEltronProtocol.h"
 #include "ValueDefinitions.h"
+#include "DeadlineQueue.h"
+#include "LatencyHistogram.h"
 #include <utility>
-#include <map>
+#include <vector>
 #include <algorithm>
+#include <cstdlib>
 #include <LittleFS.h>
 #include <gpiobj/DigitalInput.h>
 
+/**
+ * Note: the fields are ordered by size to avoid padding, as there may be
+ * many entries in memory (see DataStore). The state for polling, passing on
+ * updates and writing is kept separately (see PollState and PendingWrite),
+ * as only the configured entries need it.
+ */
 struct DataEntry {
+  iot_core::DateTime lastUpdate;
+  unsigned long lastUpdateMs;
   ValueId id;
   DeviceId source;
   uint16_t rawValue;
-  uint16_t toWrite;
-  iot_core::DateTime lastUpdate;
-  unsigned long lastUpdateMs;
-  unsigned long lastRequestMs;
-  unsigned long lastWriteMs;
-  uint8_t writeRetries;
-  bool subscribed;
-  bool writable; // NOTE: this only means that this entry has been marked for writing via the API
+  bool subscribed : 1;
+  bool writable : 1; // NOTE: this only means that this entry has been marked for writing via the API
 
   bool isConfigured() const { return subscribed || writable; }
 
-  DataEntry() : id(0), source(), rawValue(0), toWrite(0), lastUpdate(), lastUpdateMs(0), lastRequestMs(0), lastWriteMs(0), writeRetries(0), subscribed(false), writable(false) {}
+  DataEntry() : lastUpdate(), lastUpdateMs(0), id(0), source(), rawValue(0), subscribed(false), writable(false) {}
 };
 
-static const char SUBSCRIPTIONS_FILE_HEADER[] = "~S1.0";
+/**
+ * Data entries in a flat array sorted by source and value ID (packed into a
+ * 32-bit key), i.e. grouped by device type and address when iterating.
+ *
+ * Compared to a tree this avoids a heap allocation per entry. The array grows
+ * in fixed steps instead of doubling, as long as the heap has a large enough
+ * free block left (keeping a reserve for everything else). Inserting an entry
+ * moves the ones after it and invalidates pointers to entries, so these must
+ * not be kept across insertions.
+ */
+class DataStore final {
+public:
+  using Key = std::pair<DeviceId, ValueId>;
+  using const_iterator = std::vector<DataEntry>::const_iterator;
+
+  static constexpr size_t GROWTH_STEP = 16; // entries
+  static constexpr size_t HEAP_RESERVE = 8192; // bytes
+
+private:
+  std::vector<DataEntry> _entries {};
+  uint32_t _rejected = 0;
+
+public:
+  DataEntry* find(Key const& key) {
+    auto it = lowerBound(packKey(key.first, key.second));
+    return (it != _entries.end() && packKey(*it) == packKey(key.first, key.second)) ? &*it : nullptr;
+  }
+
+  const DataEntry* find(Key const& key) const {
+    return const_cast<DataStore*>(this)->find(key);
+  }
+
+  /**
+   * Returns the entry with the given key, which is added if not present yet.
+   * Returns nullptr if there is not enough memory to add it.
+   */
+  DataEntry* obtain(Key const& key) {
+    uint32_t packedKey = packKey(key.first, key.second);
+    auto it = lowerBound(packedKey);
+    if (it != _entries.end() && packKey(*it) == packedKey) {
+      return &*it;
+    }
+
+    if (_entries.size() == _entries.capacity()) {
+      size_t position = it - _entries.begin();
+      if (ESP.getMaxFreeBlockSize() < (_entries.capacity() + GROWTH_STEP) * sizeof(DataEntry) + HEAP_RESERVE) {
+        _rejected += 1;
+        return nullptr;
+      }
+      _entries.reserve(_entries.capacity() + GROWTH_STEP);
+      it = _entries.begin() + position;
+    }
+
+    DataEntry entry {};
+    entry.source = key.first;
+    entry.id = key.second;
+    return &*_entries.insert(it, entry);
+  }
+
+  const_iterator begin() const { return _entries.begin(); }
+  const_iterator end() const { return _entries.end(); }
+  std::vector<DataEntry>::iterator begin() { return _entries.begin(); }
+  std::vector<DataEntry>::iterator end() { return _entries.end(); }
+
+  size_t size() const { return _entries.size(); }
+  size_t capacity() const { return _entries.capacity(); }
+  uint32_t rejected() const { return _rejected; }
+
+  /**
+   * How many entries could be stored at most with the memory currently available.
+   */
+  size_t maxCapacity() const {
+    size_t freeBlock = ESP.getMaxFreeBlockSize();
+    return freeBlock > HEAP_RESERVE ? std::max(_entries.capacity(), (freeBlock - HEAP_RESERVE) / sizeof(DataEntry)) : _entries.capacity();
+  }
+
+private:
+  static uint32_t packKey(DeviceId const& source, ValueId id) {
+    return (static_cast<uint32_t>(source.type) << 24) | (static_cast<uint32_t>(source.address) << 16) | id;
+  }
+
+  static uint32_t packKey(DataEntry const& entry) {
+    return packKey(entry.source, entry.id);
+  }
+
+  std::vector<DataEntry>::iterator lowerBound(uint32_t packedKey) {
+    return std::lower_bound(_entries.begin(), _entries.end(), packedKey, [] (DataEntry const& entry, uint32_t key) { return packKey(entry) < key; });
+  }
+};
+
+/**
+ * A write in progress, from the request to write a value until it is
+ * confirmed by the source or given up.
+ */
+struct PendingWrite {
+  DataStore::Key key;
+  unsigned long lastWriteMs; // when the last attempt was sent (or a time in the past to send it right away)
+  uint16_t value;
+  uint8_t attempts;
+};
+
+/**
+ * State of a configured (subscribed or writable) entry for polling it and
+ * passing on its updates. It exists as long as the entry is configured.
+ */
+struct PollState {
+  DataStore::Key key;
+  unsigned long lastRequestMs;
+  unsigned long lastPassiveMs; // last update caused by other devices' traffic
+  uint32_t passiveIntervalMs; // smoothed interval between passive updates (0 = unknown)
+  uint32_t adaptiveIntervalMs; // poll interval adapted to the observed changes (0 = not adapted yet)
+  unsigned long nextDueMs; // when the entry is due in the maintenance schedule
+  uint16_t notifiedValue; // raw value last passed on to the update handlers
+  uint16_t notifiedS; // when the value was last passed on (seconds of uptime, wrapping)
+  uint16_t fixedIntervalS; // poll interval set for this entry, overrides the adaptive interval if not 0
+  uint8_t unansweredRequests; // consecutive requests without a response
+  bool pollDeferred : 1; // a due poll is held back as a passive update is expected
+  bool scheduled : 1; // whether nextDueMs is in the maintenance schedule
+  bool notified : 1; // whether notifiedValue and notifiedS are set
+
+  static constexpr uint8_t SUSPECTED_DEAD_THRESHOLD = 3;
+
+  bool isSuspectedDead() const { return unansweredRequests >= SUSPECTED_DEAD_THRESHOLD; }
+
+  PollState(DataStore::Key const& key) : key(key), lastRequestMs(0), lastPassiveMs(0), passiveIntervalMs(0), adaptiveIntervalMs(0), nextDueMs(0), notifiedValue(0), notifiedS(0), fixedIntervalS(0), unansweredRequests(0), pollDeferred(false), scheduled(false), notified(false) {}
+};
+
+/**
+ * Returns the given date/time moved back by the given number of milliseconds.
+ */
+iot_core::DateTime backdate(iot_core::DateTime dateTime, unsigned long ms) {
+  static constexpr uint32_t MS_PER_DAY = 24ul * 60ul * 60ul * 1000ul;
+  if (!dateTime.isSet() || ms == 0) {
+    return dateTime;
+  }
+
+  while (ms > MS_PER_DAY) {
+    dateTime = backdate(dateTime, MS_PER_DAY);
+    ms -= MS_PER_DAY;
+  }
+  uint32_t msOfDay = ((dateTime.hour * 60ul + dateTime.minute) * 60ul + dateTime.second) * 1000ul + dateTime.ms;
+  if (msOfDay >= ms) {
+    msOfDay -= ms;
+  } else {
+    msOfDay = msOfDay + MS_PER_DAY - ms;
+    if (dateTime.day > 1) {
+      dateTime.day = dateTime.day - 1;
+    } else {
+      static const uint8_t DAYS_IN_MONTH[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+      if (dateTime.month > 1) {
+        dateTime.month = dateTime.month - 1;
+      } else {
+        dateTime.month = 12;
+        dateTime.year = dateTime.year - 1;
+      }
+      bool leapYear = (dateTime.year % 4 == 0) && ((dateTime.year % 100 != 0) || (dateTime.year % 400 == 0));
+      dateTime.day = DAYS_IN_MONTH[dateTime.month - 1] + ((leapYear && dateTime.month == 2) ? 1 : 0);
+    }
+  }
+
+  dateTime.ms = msOfDay % 1000ul;
+  dateTime.second = (msOfDay / 1000ul) % 60ul;
+  dateTime.minute = (msOfDay / 60000ul) % 60ul;
+  dateTime.hour = msOfDay / 3600000ul;
+  return dateTime;
+}
+
+static const char SUBSCRIPTIONS_FILE_HEADER_V1_0[] = "~S1.0"; // without fixed poll interval
+static const char SUBSCRIPTIONS_FILE_HEADER[] = "~S1.1";
 static const char WRITABLES_FILE_HEADER[] = "~W1.0";
 
 enum struct DataCaptureMode : uint8_t {
@@ -82,38 +255,55 @@ const char* writeResultToString(WriteResult result) {
 
 class DataAccess final : public iot_core::IApplicationComponent, public IStiebelEltronDevice {
 public:
-  using DataKey = std::pair<DeviceId, ValueId>;
-  using DataMap = std::map<DataKey, DataEntry>;
+  using DataKey = DataStore::Key;
 
 private:
   iot_core::Logger _logger;
   iot_core::ISystem& _system;
   StiebelEltronProtocol& _protocol;
   IDefinitionRepository& _definitions;
+  const IConversionService& _conversion;
   gpiobj::DigitalInput& _writeEnablePin;
   DeviceId _deviceId;
   DataCaptureMode _mode;
   bool _readOnly;
   bool _ignoreDateTime;
-  DataMap _data;
-  DataMap::iterator _dataIterator;
-
-  std::function<void(DataEntry const& entry)> _updateHandler;
+  DataStore _data;
+  DeadlineQueue<DataKey> _schedule;
+  LatencyHistogram _scheduleLag; // how late requests and writes are sent compared to when they were due
+  std::vector<PollState> _polls; // sorted by key like the entries
+  std::vector<PendingWrite> _writes;
+
+  std::vector<std::function<void(DataEntry const& entry)>> _updateHandlers;
+  ListenerId _listener = 0;
+  bool _listening = false;
+
+  uint32_t _passiveUpdates = 0; // updates of subscriptions caused by other devices' traffic
+  uint32_t _avoidedPolls = 0; // due polls which were not needed thanks to a passive update
+  uint32_t _notifiedUpdates = 0; // updates passed on to the update handlers
+  uint32_t _suppressedUpdates = 0; // updates held back due to the notification policy
+  uint32_t _maintenanceRuns = 0;
+  uint32_t _maintenanceTimeUs = 0;
+  uint32_t _maintenanceMaxUs = 0;
 
 public:
-  DataAccess(iot_core::ISystem& system, StiebelEltronProtocol& protocol, IDefinitionRepository& definitions, gpiobj::DigitalInput& writeEnablePin)
+  DataAccess(iot_core::ISystem& system, StiebelEltronProtocol& protocol, IDefinitionRepository& definitions, const IConversionService& conversion, gpiobj::DigitalInput& writeEnablePin)
     : _logger(system.logger("dta")),
     _system(system),
     _protocol(protocol),
     _definitions(definitions),
+    _conversion(conversion),
     _writeEnablePin(writeEnablePin),
     _deviceId(),
     _mode(DataCaptureMode::Configured),
     _readOnly(true),
     _ignoreDateTime(false),
     _data(),
-    _dataIterator(_data.begin()),
-    _updateHandler()
+    _schedule(),
+    _scheduleLag(),
+    _polls(),
+    _writes(),
+    _updateHandlers()
   { }
 
   const char* name() const override {
@@ -151,6 +341,7 @@ public:
 
   bool setMode(DataCaptureMode mode) {
     _mode = mode;
+    updateInterest();
     _logger.log(toolbox::format(F("Set mode '%s'."), dataCaptureModeToString(_mode)));
     return true;
   }
@@ -172,12 +363,14 @@ public:
   }
 
   void setup(bool /*connected*/) override {
+    _listener = _protocol.addListener(name(), MessageInterest{}, [this] (ProtocolMessage const& message) { processMessage(message); });
+    _listening = true;
+
     restoreSubscriptions();
     restoreWritables();
+    updateInterest();
 
     _protocol.addDevice(this);
-    _protocol.onResponse([this] (ResponseData const& data) { processData({data.sourceId, data.valueId}, data.value); });
-    _protocol.onWrite([this] (WriteData const& data) { processData({data.targetId.isExact() ? data.targetId : data.sourceId, data.valueId}, data.value); });
   }
 
   void loop(iot_core::ConnectionStatus /*status*/) override {
@@ -188,7 +381,49 @@ public:
     maintainData();
   }
 
-  void getDiagnostics(iot_core::IDiagnosticsCollector& /*collector*/) const override {
+  void getDiagnostics(iot_core::IDiagnosticsCollector& collector) const override {
+    size_t subscribed = 0;
+    size_t passivelyRefreshed = 0;
+    size_t suspectedDead = 0;
+    size_t narrowed = 0;
+    size_t widened = 0;
+    unsigned long currentMs = millis();
+    for (auto& state : _polls) {
+      if (state.isSuspectedDead()) {
+        suspectedDead += 1;
+      }
+      const DataEntry* entry = _data.find(state.key);
+      if (entry != nullptr && entry->subscribed) {
+        subscribed += 1;
+        if (state.fixedIntervalS == 0 && state.adaptiveIntervalMs != 0) {
+          uint32_t definedMs = definedIntervalMs(state.key.second);
+          narrowed += state.adaptiveIntervalMs < definedMs ? 1 : 0;
+          widened += state.adaptiveIntervalMs > definedMs ? 1 : 0;
+        }
+        if (isPassivelyRefreshed(state, currentMs)) {
+          passivelyRefreshed += 1;
+        }
+      }
+    }
+    // passive: <subscriptions refreshed by other devices' traffic>/<subscriptions>
+    collector.addValue("passive", toolbox::format(F("%u/%u"), passivelyRefreshed, subscribed));
+    // schedule: <queued> <lag p50>/<p90>/<max> ms
+    collector.addValue("schedule", toolbox::format(F("%u %u/%u/%u ms"), _schedule.size(), _scheduleLag.percentileMs(50), _scheduleLag.percentileMs(90), _scheduleLag.maxMs()));
+    // maintenance: <runs> <avg>/<max> us
+    collector.addValue("maintenance", toolbox::format(F("%u %u/%u us"), _maintenanceRuns, _maintenanceRuns > 0 ? _maintenanceTimeUs / _maintenanceRuns : 0u, _maintenanceMaxUs));
+    // notifications: <passed on>/<suppressed>
+    collector.addValue("notifications", toolbox::format(F("%u/%u"), _notifiedUpdates, _suppressedUpdates));
+    collector.addValue("pendingWrites", toolbox::convert<size_t>::toString(_writes.size(), 10));
+    // adaptive: <polled faster>/<polled slower> than defined
+    collector.addValue("adaptive", toolbox::format(F("%u/%u"), narrowed, widened));
+    // entries: <entries>/<allocated>/<max. with free heap> x <bytes per entry> B
+    collector.addValue("entries", toolbox::format(F("%u/%u/%u x %u B"), _data.size(), _data.capacity(), _data.maxCapacity(), sizeof(DataEntry)));
+    // pollStates: <configured entries>/<allocated> x <bytes per configured entry> B
+    collector.addValue("pollStates", toolbox::format(F("%u/%u x %u B"), _polls.size(), _polls.capacity(), sizeof(PollState)));
+    collector.addValue("rejectedEntries", toolbox::convert<uint32_t>::toString(_data.rejected(), 10));
+    collector.addValue("suspectedDead", toolbox::convert<size_t>::toString(suspectedDead, 10));
+    collector.addValue("passiveUpdates", toolbox::convert<uint32_t>::toString(_passiveUpdates, 10));
+    collector.addValue("avoidedPolls", toolbox::convert<uint32_t>::toString(_avoidedPolls, 10));
   }
 
   const DeviceId& deviceId() const override {
@@ -208,31 +443,42 @@ public:
   }
 
   void onUpdate(std::function<void(DataEntry const& entry)> updateHandler) {
-    if (_updateHandler) {
-      auto previousHandler = _updateHandler;
-      _updateHandler = [=](DataEntry const& entry) { previousHandler(entry); updateHandler(entry); };
-    } else {
-      _updateHandler = updateHandler;
-    }
+    _updateHandlers.push_back(updateHandler);
   }
 
-  const DataMap& getData() const {
+  const DataStore& getData() const {
     return _data;
   }
 
   const DataEntry* getEntry(DataKey const& key) const {
-    auto result = _data.find(key);
-    if (result == _data.end()) {
-      return nullptr;
-    } else {
-      return &result->second;
-    }
+    return _data.find(key);
+  }
+
+  /**
+   * The polling state of the entry, which only configured entries have.
+   */
+  const PollState* getPollState(DataKey const& key) const {
+    return const_cast<DataAccess*>(this)->getPollStateInternal(key);
+  }
+
+  /**
+   * Interval with which the entry is polled if subscribed: the fixed interval,
+   * if set, otherwise the adapted or (until adapted) the defined interval.
+   */
+  uint32_t pollIntervalMs(DataEntry const& entry) const {
+    const PollState* state = getPollState({entry.source, entry.id});
+    return state != nullptr ? pollIntervalMs(*state) : definedIntervalMs(entry.id);
   }
 
-  bool addSubscription(DataKey const& key) {
-    bool added = addSubscriptionInternal(key);
+  /**
+   * Subscribe to the value, which is then polled with an interval adapted to how
+   * often it changes, or with the given fixed interval (if not 0).
+   */
+  bool addSubscription(DataKey const& key, uint16_t fixedIntervalS = 0) {
+    bool added = addSubscriptionInternal(key, fixedIntervalS);
     if (added) {
       persistSubscriptions();
+      updateInterest();
     }
     return added;
   }
@@ -240,12 +486,14 @@ public:
   void removeSubscription(DataKey const& key) {
     removeSubscriptionInternal(key);
     persistSubscriptions();
+    updateInterest();
   }
 
   bool addWritable(DataKey const& key) {
     bool added = addWritableInternal(key);
     if (added) {
       persistWritables();
+      updateInterest();
     }
     return added;
   }
@@ -253,6 +501,7 @@ public:
   void removeWritable(DataKey const& key) {
     removeWritableInternal(key);
     persistWritables();
+    updateInterest();
   }
 
   const iot_core::DateTime& currentDateTime() const {
@@ -280,9 +529,14 @@ public:
       return WriteResult::ConfirmationRequired;
     }
 
-    entry->toWrite = rawValue;
-    entry->lastWriteMs = millis() - WRITE_INTERVAL_MS; // Schedule immediate write on next maintenance cycle
-    entry->writeRetries = 0;
+    PendingWrite* pending = getPendingWrite(key);
+    if (pending == nullptr) {
+      _writes.push_back({key, 0, 0, 0});
+      pending = &_writes.back();
+    }
+    pending->value = rawValue;
+    pending->lastWriteMs = millis() - WRITE_INTERVAL_MS; // Immediate write on next maintenance cycle
+    pending->attempts = 0;
     _logger.log(iot_core::LogLevel::Info, toolbox::format(F("Write scheduled for %u: %u"), entry->id, rawValue));
     return WriteResult::Accepted;
   }
@@ -293,15 +547,74 @@ private:
   }
 
   DataEntry* getEntryInternal(DataKey const& key) {
-    auto result = _data.find(key);
-    if (result == _data.end()) {
-      return nullptr;
-    } else {
-      return &result->second;
+    return _data.find(key);
+  }
+
+  PollState* getPollStateInternal(DataKey const& key) {
+    auto it = lowerBoundPollState(key);
+    return (it != _polls.end() && it->key == key) ? &*it : nullptr;
+  }
+
+  PollState& obtainPollState(DataKey const& key) {
+    auto it = lowerBoundPollState(key);
+    if (it != _polls.end() && it->key == key) {
+      return *it;
     }
+    return *_polls.insert(it, PollState{key});
+  }
+
+  /**
+   * Drop the polling state once the entry is not configured anymore, which
+   * also takes it out of the schedule (see doDataMaintenance).
+   */
+  void releasePollState(DataEntry const& entry) {
+    if (entry.isConfigured()) {
+      return;
+    }
+    auto it = lowerBoundPollState({entry.source, entry.id});
+    if (it != _polls.end() && it->key == DataKey{entry.source, entry.id}) {
+      _polls.erase(it);
+    }
+  }
+
+  std::vector<PollState>::iterator lowerBoundPollState(DataKey const& key) {
+    return std::lower_bound(_polls.begin(), _polls.end(), key, [] (PollState const& state, DataKey const& other) { return state.key < other; });
   }
   
-  bool addSubscriptionInternal(DataKey const& key) {
+  /**
+   * Let the protocol know which messages we need to receive. Only in the
+   * Configured mode this is limited to the devices and IDs of configured entries.
+   */
+  void updateInterest() {
+    std::vector<DeviceId> sources {};
+    MessageInterest interest {};
+    if (_mode == DataCaptureMode::Configured) {
+      std::vector<ValueId> valueIds {};
+      for (auto& entry : _data) {
+        if (entry.isConfigured()) {
+          // entries are sorted by source, so consecutive duplicates are enough to skip
+          if (sources.empty() || !(sources.back() == entry.source)) {
+            sources.push_back(entry.source);
+          }
+          valueIds.push_back(entry.id);
+        }
+      }
+      std::sort(valueIds.begin(), valueIds.end());
+      valueIds.erase(std::unique(valueIds.begin(), valueIds.end()), valueIds.end());
+      if (!valueIds.empty()) {
+        interest.type(MessageType::Response).type(MessageType::Write).ids(std::move(valueIds));
+      }
+    } else if (_mode != DataCaptureMode::None) {
+      sources.push_back(DeviceId()); // any source
+      interest.type(MessageType::Response).type(MessageType::Write);
+    }
+    _protocol.setAcceptedSources(name(), std::move(sources));
+    if (_listening) {
+      _protocol.setInterest(_listener, std::move(interest));
+    }
+  }
+
+  bool addSubscriptionInternal(DataKey const& key, uint16_t fixedIntervalS) {
     if (!key.first.isExact()) {
       // Subscription has to be to a specific device ID
       return false;
@@ -312,17 +625,25 @@ private:
       return false;
     }
 
-    auto& entry = _data[key];
-    entry.source = key.first;
-    entry.id = key.second;
-    entry.subscribed = true;
+    DataEntry* entry = _data.obtain(key);
+    if (entry == nullptr) {
+      _logger.log(iot_core::LogLevel::Error, toolbox::format(F("Not enough memory to subscribe to %u."), key.second));
+      return false;
+    }
+    entry->subscribed = true;
+    PollState& state = obtainPollState(key);
+    state.fixedIntervalS = fixedIntervalS != 0 ? std::max<uint16_t>(fixedIntervalS, MIN_ADAPTIVE_INTERVAL_MS / 1000u) : 0;
+    schedule(state, millis());
 
     return true;
   }
 
   void removeSubscriptionInternal(DataKey const& key) {
-    auto& entry = _data[key];
-    entry.subscribed = false;
+    DataEntry* entry = _data.find(key);
+    if (entry != nullptr) {
+      entry->subscribed = false;
+      releasePollState(*entry);
+    }
   }
 
   void restoreSubscriptions() {
@@ -331,13 +652,16 @@ private:
       if (subscriptionsFile.available() > 5) {
         char header[6] = {0};
         subscriptionsFile.readBytes(header, 5);
-        if (strcmp(header, SUBSCRIPTIONS_FILE_HEADER) == 0) {
-          uint8_t entry[4] = {0};
+        bool withInterval = strcmp(header, SUBSCRIPTIONS_FILE_HEADER) == 0;
+        if (withInterval || strcmp(header, SUBSCRIPTIONS_FILE_HEADER_V1_0) == 0) {
+          size_t entrySize = withInterval ? 6 : 4;
+          uint8_t entry[6] = {0};
           while (subscriptionsFile.available()) {
-            if (subscriptionsFile.read(entry, 4) == 4) {
+            if (subscriptionsFile.read(entry, entrySize) == entrySize) {
               ValueId valueId {(entry[0] << 8) | entry[1]};
               DeviceId deviceId {DeviceType(entry[2]), entry[3]};
-              addSubscriptionInternal({deviceId, valueId});
+              uint16_t fixedIntervalS = withInterval ? (entry[4] << 8) | entry[5] : 0;
+              addSubscriptionInternal({deviceId, valueId}, fixedIntervalS);
             }
             _system.lyield();
           }
@@ -354,15 +678,18 @@ private:
     auto subscriptionsFile = LittleFS.open("/subscriptions", "w");
     if (subscriptionsFile) {
       subscriptionsFile.write(SUBSCRIPTIONS_FILE_HEADER);
-      for (auto& data : _data) {
-        if (data.second.subscribed) {
-          uint8_t entry[4] = {
-            (data.second.id >> 8) & 0xFFu,
-            data.second.id & 0xFFu,
-            static_cast<uint8_t>(data.second.source.type),
-            data.second.source.address
+      for (auto& entry : _data) {
+        const PollState* state = entry.subscribed ? getPollState({entry.source, entry.id}) : nullptr;
+        if (state != nullptr) {
+          uint8_t bytes[6] = {
+            (entry.id >> 8) & 0xFFu,
+            entry.id & 0xFFu,
+            static_cast<uint8_t>(entry.source.type),
+            entry.source.address,
+            (state->fixedIntervalS >> 8) & 0xFFu,
+            state->fixedIntervalS & 0xFFu
           };
-          subscriptionsFile.write(entry, 4);
+          subscriptionsFile.write(bytes, 6);
         }
         _system.lyield();
       }
@@ -381,17 +708,33 @@ private:
       return false;
     }
 
-    auto& entry = _data[key];
-    entry.source = key.first;
-    entry.id = key.second;
-    entry.writable = true;
+    DataEntry* entry = _data.obtain(key);
+    if (entry == nullptr) {
+      _logger.log(iot_core::LogLevel::Error, toolbox::format(F("Not enough memory to make %u writable."), key.second));
+      return false;
+    }
+    entry->writable = true;
+    schedule(obtainPollState(key), millis());
 
     return true;
   }
 
   void removeWritableInternal(DataKey const& key) {
-    auto& entry = _data[key];
-    entry.writable = false;
+    DataEntry* entry = _data.find(key);
+    if (entry != nullptr) {
+      entry->writable = false;
+      releasePollState(*entry);
+    }
+    removePendingWrite(key);
+  }
+
+  PendingWrite* getPendingWrite(DataKey const& key) {
+    auto it = std::find_if(_writes.begin(), _writes.end(), [&key] (PendingWrite const& pending) { return pending.key == key; });
+    return it != _writes.end() ? &*it : nullptr;
+  }
+
+  void removePendingWrite(DataKey const& key) {
+    _writes.erase(std::remove_if(_writes.begin(), _writes.end(), [&key] (PendingWrite const& pending) { return pending.key == key; }), _writes.end());
   }
   
   void restoreWritables() {
@@ -423,15 +766,15 @@ private:
     auto writablesFile = LittleFS.open("/writables", "w");
     if (writablesFile) {
       writablesFile.write(WRITABLES_FILE_HEADER);
-      for (auto& data : _data) {
-        if (data.second.writable) {
-          uint8_t entry[4] = {
-            (data.second.id >> 8) & 0xFFu,
-            data.second.id & 0xFFu,
-            static_cast<uint8_t>(data.second.source.type),
-            data.second.source.address
+      for (auto& entry : _data) {
+        if (entry.writable) {
+          uint8_t bytes[4] = {
+            (entry.id >> 8) & 0xFFu,
+            entry.id & 0xFFu,
+            static_cast<uint8_t>(entry.source.type),
+            entry.source.address
           };
-          writablesFile.write(entry, 4);
+          writablesFile.write(bytes, 4);
         }
         _system.lyield();
       }
@@ -439,74 +782,234 @@ private:
     }
   }
 
-  // Note: CAN bus protection is handled by SerialCan with token bucket rate limiting
+  // Note: CAN bus protection is handled by SerialCan with a prioritized TX queue and token bucket rate limiting
   // These constants control retry behavior and timing, not rate limiting
   static constexpr uint32_t MIN_UPDATE_INTERVAL_MS = 30000; // Min 30s between subscription requests
-  static constexpr unsigned long WRITE_INTERVAL_MS = 3000; // 3s between write retries
+  static constexpr unsigned long WRITE_INTERVAL_MS = 3000; // 3s between write retries (from the confirmed transmission)
   static constexpr unsigned long WRITE_VERIFY_DELAY_MS = 1000; // Wait 1s after write before requesting verification
   static constexpr uint8_t MAX_WRITE_RETRIES = 5; // Limit write attempts to avoid infinite retries
   static constexpr unsigned long MAINTENANCE_INTERVAL_MS = 100; // Check every 100ms
+  static constexpr unsigned long MIN_PASSIVE_INTERVAL_MS = 1000; // Passive updates closer together are not counted as separate refreshes
+  static constexpr uint32_t PASSIVE_GRACE_DIVISOR = 4; // Wait up to 1/4 of the passive interval for an overdue passive update
+  static constexpr uint32_t MAX_REQUEST_INTERVAL_MS = 30ul * 60ul * 1000ul; // Back off unanswered requests up to 30min
+  static constexpr uint32_t MIN_ADAPTIVE_INTERVAL_MS = 10000; // Volatile values are polled at most every 10s
+  static constexpr uint32_t ADAPTIVE_RANGE_FACTOR = 4; // Adapt the poll interval between 1/4 and 4 times the defined interval
+  static constexpr uint16_t MINOR_CHANGE = 1; // Raw value changes up to this are considered noise
+
+  /**
+   * Interval for polling the entry as defined, i.e. before adaptation.
+   */
+  uint32_t definedIntervalMs(ValueId id) const {
+    return std::max(MIN_UPDATE_INTERVAL_MS, getDefinition(id).updateIntervalMs);
+  }
+
+  uint32_t pollIntervalMs(PollState const& state) const {
+    if (state.fixedIntervalS != 0) {
+      return state.fixedIntervalS * 1000ul;
+    }
+    return state.adaptiveIntervalMs != 0 ? state.adaptiveIntervalMs : definedIntervalMs(state.key.second);
+  }
+
+  /**
+   * Widen the poll interval while the value does not change and narrow it when
+   * it changes more than minor, within the range given by the definition.
+   */
+  void adaptPollInterval(DataEntry const& entry, PollState& state, uint16_t previousValue) {
+    if (!entry.subscribed || state.fixedIntervalS != 0) {
+      return;
+    }
+
+    uint32_t definedMs = definedIntervalMs(entry.id);
+    uint32_t intervalMs = pollIntervalMs(state);
+    uint16_t change = std::abs(static_cast<int16_t>(entry.rawValue - previousValue));
+    if (change == 0) {
+      intervalMs += intervalMs / 4;
+    } else if (change > MINOR_CHANGE) {
+      intervalMs /= 2;
+    }
+    state.adaptiveIntervalMs = std::min(std::max(intervalMs, std::max(MIN_ADAPTIVE_INTERVAL_MS, definedMs / ADAPTIVE_RANGE_FACTOR)), definedMs * ADAPTIVE_RANGE_FACTOR);
+  }
+
+  /**
+   * Minimum interval between requests for the entry, doubled for each
+   * consecutive request the source did not answer (up to a maximum).
+   */
+  uint32_t requestIntervalMs(PollState const& state) const {
+    uint8_t backoff = std::min<uint8_t>(state.unansweredRequests, 6u);
+    return std::min(std::min(MIN_UPDATE_INTERVAL_MS, pollIntervalMs(state)) << backoff, MAX_REQUEST_INTERVAL_MS);
+  }
+
+  /**
+   * Backdate the last request of the entry so that the request verifying a
+   * write becomes due WRITE_VERIFY_DELAY_MS after the write.
+   */
+  void delayVerification(PollState& state, unsigned long writeMs) const {
+    state.lastRequestMs = writeMs + WRITE_VERIFY_DELAY_MS - requestIntervalMs(state);
+  }
+
+  void countUnansweredRequest(PollState& state) {
+    if (state.unansweredRequests < UINT8_MAX) {
+      state.unansweredRequests += 1;
+    }
+    if (state.unansweredRequests == PollState::SUSPECTED_DEAD_THRESHOLD) {
+      _logger.log(iot_core::LogLevel::Warning, toolbox::format(F("No value for %u from %s, backing off."), state.key.second, state.key.first.toString()));
+    }
+  }
+
+  void processRequestOutcome(DataKey const& key, RequestOutcome outcome, ResponseData const* response) {
+    PollState* state = getPollStateInternal(key);
+    if (state == nullptr) {
+      return;
+    }
+
+    switch (outcome) {
+      case RequestOutcome::Responded:
+        // Any other update proves the value is alive, which is handled with the data itself.
+        // The source does not support the ID (or has no value for it), so this counts as unanswered.
+        if (response->value == VALUE_NOT_AVAILABLE) {
+          countUnansweredRequest(*state);
+        }
+        break;
+      case RequestOutcome::TimedOut:
+        countUnansweredRequest(*state);
+        break;
+      case RequestOutcome::NotSent:
+        state->lastRequestMs = 0; // the request never made it to the bus, so repeat it on the next occasion
+        schedule(*state, millis());
+        break;
+    }
+  }
+
+  /**
+   * Whether other devices' traffic currently refreshes the entry at least as
+   * often as its update interval requires, i.e. polling it ourselves is not needed.
+   */
+  bool isPassivelyRefreshed(PollState const& state, unsigned long currentMs) const {
+    if (state.passiveIntervalMs == 0 || state.lastPassiveMs == 0) {
+      return false;
+    }
+    uint32_t updateIntervalMs = pollIntervalMs(state);
+    return state.passiveIntervalMs <= updateIntervalMs && currentMs - state.lastPassiveMs <= 2 * state.passiveIntervalMs;
+  }
+
+  void trackPassiveUpdate(DataEntry const& entry, PollState& state, unsigned long receivedMs) {
+    if (state.lastPassiveMs != 0) {
+      uint32_t intervalMs = receivedMs - state.lastPassiveMs;
+      if (intervalMs < MIN_PASSIVE_INTERVAL_MS) {
+        return;
+      }
+      state.passiveIntervalMs = state.passiveIntervalMs == 0 ? intervalMs : (3 * state.passiveIntervalMs + intervalMs) / 4;
+    }
+    state.lastPassiveMs = receivedMs;
+
+    if (entry.subscribed) {
+      _passiveUpdates += 1;
+      if (state.pollDeferred) {
+        _avoidedPolls += 1;
+        state.pollDeferred = false;
+      }
+    }
+  }
 
   iot_core::IntervalTimer _maintenanceInterval {MAINTENANCE_INTERVAL_MS};
 
   void maintainData() {
     if (_maintenanceInterval.elapsed()) {
       unsigned long currentMs = millis();
-      doDataMaintenance(currentMs);
+      uint32_t startUs = micros();
+      if (doWriteMaintenance(currentMs)) {
+        doDataMaintenance(currentMs);
+      }
+      uint32_t durationUs = micros() - startUs;
+      _maintenanceRuns += 1;
+      _maintenanceTimeUs += durationUs;
+      _maintenanceMaxUs = std::max(_maintenanceMaxUs, durationUs);
       _maintenanceInterval.restart();
     }
   }
 
-  void doDataMaintenance(unsigned long currentMs) {
-    size_t remainingDataEntries = _data.size();
-    while (remainingDataEntries > 0) {
-      if (_dataIterator == _data.end()) {
-        _dataIterator = _data.begin();
+  /**
+   * Send the pending writes which are due. Returns false if no more frames
+   * are accepted for now.
+   */
+  bool doWriteMaintenance(unsigned long currentMs) {
+    for (auto it = _writes.begin(); it != _writes.end();) {
+      PendingWrite& pending = *it;
+      DataEntry* entry = getEntryInternal(pending.key);
+      PollState* state = getPollStateInternal(pending.key);
+      if (entry == nullptr || state == nullptr || !entry->writable) {
+        it = _writes.erase(it);
+        continue;
       }
-      
-      DataEntry& entry = _dataIterator->second;
-
-      OperationResult sendResult = OperationResult::Accepted;
-      if (entry.writable) {
-        if (entry.lastUpdateMs != 0) { // we already have received a value from the source
-          if (entry.lastWriteMs != 0 && (currentMs > entry.lastWriteMs + WRITE_INTERVAL_MS)) {
-            if (entry.writeRetries >= MAX_WRITE_RETRIES) {
-              _logger.log(iot_core::LogLevel::Warning, toolbox::format(F("Write failed after %u retries for %u (wanted: %u, current: %u)"), 
-                entry.writeRetries, entry.id, entry.toWrite, entry.rawValue));
-              entry.lastWriteMs = 0; // Give up on this write
-              entry.writeRetries = 0;
-            } else {
-              _logger.log(iot_core::LogLevel::Debug, toolbox::format(F("Write attempt %u for %u: %u"), entry.writeRetries + 1, entry.id, entry.toWrite));
-              sendResult = _protocol.write({ _deviceId, entry.source, entry.id, entry.toWrite });
-              if (sendResult == OperationResult::Accepted) {
-                entry.lastWriteMs = currentMs;
-                entry.writeRetries++;
-                // Wait a bit before requesting verification to give the target time to process
-                entry.lastRequestMs = currentMs + WRITE_VERIFY_DELAY_MS - MIN_UPDATE_INTERVAL_MS;
-                entry.lastUpdateMs = 0; // triggers request for new value from source after delay
-              }
-            }
-          }
-        } else { // request the value from the source first before allowing to write it
-          if (currentMs > entry.lastRequestMs + MIN_UPDATE_INTERVAL_MS) {
-            _logger.log(iot_core::LogLevel::Debug, toolbox::format(F("Requesting initial value for writable %u"), entry.id));
-            sendResult = _protocol.request({ _deviceId, entry.source, entry.id });
-            if (sendResult == OperationResult::Accepted) {
-              entry.lastRequestMs = currentMs;
-            }
-          }
-        }
-      } else if (entry.subscribed) {
-        if (currentMs > entry.lastUpdateMs + std::max(MIN_UPDATE_INTERVAL_MS, getDefinition(entry.id).updateIntervalMs)
-          && currentMs > entry.lastRequestMs + MIN_UPDATE_INTERVAL_MS) {
-          _logger.log(iot_core::LogLevel::Debug, toolbox::format(F("Requesting update for subscribed %u"), entry.id));
-          sendResult = _protocol.request({ _deviceId, entry.source, entry.id });
-          if (sendResult == OperationResult::Accepted) {
-            entry.lastRequestMs = currentMs;
+
+      // The value has to be received from the source first before writing it
+      // (initially and to verify the previous attempt).
+      if (entry->lastUpdateMs == 0 || currentMs <= pending.lastWriteMs + WRITE_INTERVAL_MS) {
+        ++it;
+        continue;
+      }
+
+      if (pending.attempts >= MAX_WRITE_RETRIES) {
+        _logger.log(iot_core::LogLevel::Warning, toolbox::format(F("Write failed after %u retries for %u (wanted: %u, current: %u)"), 
+          pending.attempts, entry->id, pending.value, entry->rawValue));
+        it = _writes.erase(it); // Give up on this write
+        continue;
+      }
+
+      _logger.log(iot_core::LogLevel::Debug, toolbox::format(F("Write attempt %u for %u: %u"), pending.attempts + 1, entry->id, pending.value));
+      DataKey key = pending.key;
+      unsigned long previousUpdateMs = entry->lastUpdateMs;
+      OperationResult sendResult = _protocol.write({ _deviceId, entry->source, entry->id, pending.value }, [this, key, currentMs, previousUpdateMs] (bool sent) {
+        processWriteCompletion(key, currentMs, previousUpdateMs, sent);
+      });
+      switch (sendResult) {
+        case OperationResult::Accepted: {
+          _scheduleLag.add(currentMs - (pending.lastWriteMs + WRITE_INTERVAL_MS));
+          pending.lastWriteMs = currentMs;
+          pending.attempts++;
+          // Wait a bit before requesting verification to give the target time to process
+          delayVerification(*state, currentMs);
+          entry->lastUpdateMs = 0; // triggers request for new value from source after delay
+          unsigned long dueMs;
+          if (nextDueMs(*entry, *state, dueMs)) {
+            schedule(*state, dueMs);
           }
+          ++it;
+          break;
         }
+        case OperationResult::Invalid:
+          // Should normally not happen, but if it does, sending it again will not help
+          _logger.log(iot_core::LogLevel::Error, toolbox::format(F("Failed to send write for %u: Invalid parameters."), entry->id));
+          it = _writes.erase(it);
+          break;
+        case OperationResult::NotReady:
+        case OperationResult::RateLimited:
+        case OperationResult::QueueFull:
+          _logger.log(iot_core::LogLevel::Debug, toolbox::format(F("Deferring further data maintenance due to %s."), operationResultToString(sendResult)));
+          return false;
+      }
+
+      _system.lyield();
+    }
+    return true;
+  }
+
+  /**
+   * Process all entries which are due, earliest deadline first. Entries are
+   * only scheduled if they are configured, and rescheduled for when their next
+   * request becomes due after being processed.
+   */
+  void doDataMaintenance(unsigned long currentMs) {
+    while (_schedule.due(currentMs)) {
+      auto item = _schedule.pop();
+      DataEntry* entry = getEntryInternal(item.key);
+      PollState* state = getPollStateInternal(item.key);
+      if (entry == nullptr || state == nullptr || !state->scheduled || state->nextDueMs != item.dueMs) {
+        continue; // rescheduled or not configured anymore in the meantime
       }
+      state->scheduled = false;
 
+      OperationResult sendResult = maintainEntry(item.key, *entry, *state, currentMs, item.dueMs);
       switch (sendResult)
       {
         case OperationResult::Accepted:
@@ -514,24 +1017,179 @@ private:
           break;
         case OperationResult::Invalid:
           // Should normally not happen, but if it does, skip this entry this time and proceed with next entry
-          _logger.log(iot_core::LogLevel::Error, toolbox::format(F("Failed to send request/write for %u: Invalid parameters."), entry.id));
+          _logger.log(iot_core::LogLevel::Error, toolbox::format(F("Failed to send request/write for %u: Invalid parameters."), entry->id));
           break;
         case OperationResult::NotReady:
         case OperationResult::RateLimited:
         case OperationResult::QueueFull:
-          // stop processing for now, try again later
+          // stop processing for now, try again later while keeping the entry's place in the schedule
           _logger.log(iot_core::LogLevel::Debug, toolbox::format(F("Deferring further data maintenance due to %s."), operationResultToString(sendResult)));
+          schedule(*state, item.dueMs);
           return;
       }
 
-      ++_dataIterator;
-      --remainingDataEntries;
+      unsigned long dueMs;
+      if (nextDueMs(*entry, *state, dueMs)) {
+        schedule(*state, static_cast<long>(dueMs - currentMs) > 0 ? dueMs : currentMs + 1);
+      }
 
       _system.lyield();
     }
   }
 
-  void processData(DataKey const& key, uint16_t value) {
+  OperationResult maintainEntry(DataKey const& key, DataEntry const& entry, PollState& state, unsigned long currentMs, unsigned long dueMs) {
+    OperationResult sendResult = OperationResult::Accepted;
+    if (entry.writable) {
+      if (entry.lastUpdateMs == 0) { // request the value from the source first before allowing to write it (see doWriteMaintenance)
+        if (currentMs > state.lastRequestMs + requestIntervalMs(state)) {
+          _logger.log(iot_core::LogLevel::Debug, toolbox::format(F("Requesting initial value for writable %u"), entry.id));
+          sendResult = requestValue(key, entry);
+          if (sendResult == OperationResult::Accepted) {
+            state.lastRequestMs = currentMs;
+          }
+        }
+      }
+    } else if (entry.subscribed) {
+      uint32_t updateIntervalMs = pollIntervalMs(state);
+      if (currentMs > entry.lastUpdateMs + updateIntervalMs
+        && currentMs > state.lastRequestMs + requestIntervalMs(state)) {
+        if (isPassivelyRefreshed(state, currentMs) && currentMs <= entry.lastUpdateMs + updateIntervalMs + state.passiveIntervalMs / PASSIVE_GRACE_DIVISOR) {
+          // Other devices request this value often enough, so give them a bit more time
+          state.pollDeferred = true;
+        } else {
+          _logger.log(iot_core::LogLevel::Debug, toolbox::format(F("Requesting update for subscribed %u"), entry.id));
+          sendResult = requestValue(key, entry);
+          if (sendResult == OperationResult::Accepted) {
+            state.lastRequestMs = currentMs;
+            state.pollDeferred = false;
+          }
+        }
+      }
+    }
+
+    if (sendResult == OperationResult::Accepted && state.lastRequestMs == currentMs) {
+      _scheduleLag.add(currentMs - dueMs);
+    }
+    return sendResult;
+  }
+
+  /**
+   * Put the entry into the schedule, unless it is already scheduled earlier.
+   */
+  void schedule(PollState& state, unsigned long dueMs) {
+    if (state.scheduled && static_cast<long>(dueMs - state.nextDueMs) >= 0) {
+      return;
+    }
+    state.scheduled = true;
+    state.nextDueMs = dueMs;
+    _schedule.push(dueMs, state.key);
+  }
+
+  /**
+   * When the entry needs to be checked next: this must not be later than the
+   * conditions in maintainEntry() become true, but may be earlier. Returns false
+   * if nothing is pending for the entry until it gets changed.
+   */
+  bool nextDueMs(DataEntry const& entry, PollState const& state, unsigned long& dueMs) const {
+    if (entry.writable) {
+      if (entry.lastUpdateMs != 0) {
+        return false; // scheduled again when a write is sent
+      }
+      dueMs = state.lastRequestMs + requestIntervalMs(state) + 1;
+      return true;
+    } else if (entry.subscribed) {
+      uint32_t updateIntervalMs = pollIntervalMs(state);
+      dueMs = std::max<unsigned long>(entry.lastUpdateMs + updateIntervalMs, state.lastRequestMs + requestIntervalMs(state)) + 1;
+      if (state.pollDeferred) {
+        // check again when the grace period ends or the passive updates are considered gone
+        unsigned long graceEndMs = entry.lastUpdateMs + updateIntervalMs + state.passiveIntervalMs / PASSIVE_GRACE_DIVISOR + 1;
+        unsigned long passiveEndMs = state.lastPassiveMs + 2 * state.passiveIntervalMs + 1;
+        dueMs = std::max(dueMs, std::min(graceEndMs, passiveEndMs));
+      }
+      return true;
+    }
+    return false;
+  }
+
+  OperationResult requestValue(DataKey const& key, DataEntry const& entry) {
+    return _protocol.request({ _deviceId, entry.source, entry.id }, TrafficClass::Poll, [this, key] (RequestOutcome outcome, ResponseData const* response) {
+      processRequestOutcome(key, outcome, response);
+    });
+  }
+
+  void processWriteCompletion(DataKey const& key, unsigned long writeMs, unsigned long previousUpdateMs, bool sent) {
+    PendingWrite* pending = getPendingWrite(key);
+    DataEntry* entry = getEntryInternal(key);
+    PollState* state = getPollStateInternal(key);
+    if (pending == nullptr || entry == nullptr || state == nullptr || pending->lastWriteMs != writeMs) {
+      return; // the write has been confirmed, given up or superseded in the meantime
+    }
+
+    unsigned long currentMs = millis();
+    if (sent) {
+      // Time verification and retry from the actual transmission instead of from queueing
+      pending->lastWriteMs = currentMs;
+      delayVerification(*state, currentMs);
+    } else {
+      // The write never made it to the bus, so there is nothing to verify: retry right away
+      _logger.log(iot_core::LogLevel::Warning, toolbox::format(F("Write attempt %u for %u was not sent."), pending->attempts, entry->id));
+      if (entry->lastUpdateMs == 0) {
+        entry->lastUpdateMs = previousUpdateMs;
+      }
+      pending->lastWriteMs = currentMs - WRITE_INTERVAL_MS;
+    }
+  }
+
+  /**
+   * Whether the update of the entry is passed on to the update handlers,
+   * according to the notification policy of its definition. Regardless of
+   * the policy, an update is passed on if there was none for the heartbeat
+   * interval, so that consumers can tell the value is still alive. Updates of
+   * entries which are not configured (i.e. have no state) are always passed on.
+   */
+  bool shouldNotify(DataEntry const& entry, PollState const* state, unsigned long currentMs) const {
+    auto& definition = getDefinition(entry.id);
+    if (state == nullptr || !state->notified || definition.notify == NotifyPolicy::Always) {
+      return true;
+    }
+
+    if (definition.heartbeatS != 0 && static_cast<uint16_t>(currentMs / 1000u - state->notifiedS) >= definition.heartbeatS) {
+      return true;
+    }
+
+    if (definition.notify == NotifyPolicy::Change) {
+      return entry.rawValue != state->notifiedValue;
+    }
+
+    Conversion conversion = _conversion.getConversion(entry.id);
+    auto value = conversion.codec().decode(entry.rawValue);
+    auto notifiedValue = conversion.codec().decode(state->notifiedValue);
+    if (!value || !notifiedValue) {
+      return entry.rawValue != state->notifiedValue;
+    }
+
+    // compare in the decoded value's scale, with the deadband given in hundredths
+    int64_t change = std::abs(static_cast<int64_t>(value.get()) - notifiedValue.get());
+    int64_t deadband = definition.deadband;
+    if (definition.notify == NotifyPolicy::Deadband) {
+      for (uint8_t i = 0; i < conversion.converter().decimalPlaces(); ++i) {
+        deadband *= 10;
+      }
+      return change * 100 > deadband;
+    } else { // RelativeDeadband
+      return change * 10000 > deadband * std::abs(static_cast<int64_t>(notifiedValue.get()));
+    }
+  }
+
+  void processMessage(ProtocolMessage const& message) {
+    if (message.type == MessageType::Response) {
+      processData({message.sourceId, message.valueId}, message.value, message.timestampMs, message.targetId != _deviceId);
+    } else {
+      processData({message.targetId.isExact() ? message.targetId : message.sourceId, message.valueId}, message.value, message.timestampMs, true);
+    }
+  }
+
+  void processData(DataKey const& key, uint16_t value, unsigned long timestampMs, bool passive) {
     if (_mode == DataCaptureMode::None) {
       return;
     }
@@ -546,10 +1204,10 @@ private:
           entry = getEntryInternal(key);
           break;
         case DataCaptureMode::Defined:
-          entry = getDefinition(key.second).isUndefined() ? nullptr : &_data[key];
+          entry = getDefinition(key.second).isUndefined() ? nullptr : _data.obtain(key);
           break;
         case DataCaptureMode::Any:
-          entry = &_data[key];
+          entry = _data.obtain(key);
           break;
         default:
           entry = nullptr;
@@ -562,19 +1220,56 @@ private:
 
       entry->source = key.first;
       entry->id = key.second;
+      // Use the time the value was actually received from the bus, if available
+      unsigned long currentMs = millis();
+      unsigned long receivedMs = timestampMs != 0 ? timestampMs : currentMs;
+      uint16_t previousValue = entry->rawValue;
+      bool hadValue = entry->lastUpdateMs != 0 || entry->lastUpdate.isSet();
       entry->rawValue = value;
-      entry->lastUpdate = now;
-      entry->lastUpdateMs = millis();
+      entry->lastUpdate = backdate(now, currentMs - receivedMs);
+      entry->lastUpdateMs = receivedMs;
+      PollState* state = getPollStateInternal(key);
+      if (state != nullptr) {
+        if (passive) {
+          trackPassiveUpdate(*entry, *state, receivedMs);
+        }
+        bool available = value != VALUE_NOT_AVAILABLE;
+        if (available) {
+          if (state->isSuspectedDead()) {
+            _logger.log(iot_core::LogLevel::Info, toolbox::format(F("Value %u from %s is back after %u unanswered requests."), entry->id, entry->source.toString(), state->unansweredRequests));
+          }
+          state->unansweredRequests = 0;
+        }
+        if (hadValue && available && previousValue != VALUE_NOT_AVAILABLE) {
+          adaptPollInterval(*entry, *state, previousValue);
+          unsigned long dueMs;
+          if (entry->subscribed && nextDueMs(*entry, *state, dueMs)) {
+            schedule(*state, dueMs); // only has an effect if the interval got narrower
+          }
+        }
+      }
 
-      if (entry->lastWriteMs > 0 && entry->toWrite == entry->rawValue) {
+      PendingWrite* pending = _writes.empty() ? nullptr : getPendingWrite(key);
+      if (pending != nullptr && pending->value == entry->rawValue) {
         // As there is currently a write in progress and we just received
         // the new value which is now the same, we consider it done.
-        _logger.log(iot_core::LogLevel::Info, toolbox::format(F("Write confirmed for %u: %u (after %u attempts)"), entry->id, entry->rawValue, entry->writeRetries));
-        entry->lastWriteMs = 0;
-        entry->writeRetries = 0;
+        _logger.log(iot_core::LogLevel::Info, toolbox::format(F("Write confirmed for %u: %u (after %u attempts)"), entry->id, entry->rawValue, pending->attempts));
+        removePendingWrite(key);
       }
 
-      if (_updateHandler) _updateHandler(*entry);
+      if (shouldNotify(*entry, state, currentMs)) {
+        if (state != nullptr) {
+          state->notified = true;
+          state->notifiedValue = entry->rawValue;
+          state->notifiedS = currentMs / 1000u;
+        }
+        _notifiedUpdates += 1;
+        for (auto& updateHandler : _updateHandlers) {
+          updateHandler(*entry);
+        }
+      } else {
+        _suppressedUpdates += 1;
+      }
     }
   }
 };
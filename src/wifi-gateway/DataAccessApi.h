@@ -25,10 +25,17 @@ class DataConfig final {
   DeviceId _source {};
   bool _subscribed {false};
   bool _writable {false};
+  uint16_t _pollIntervalS {0}; // fixed poll interval, 0 for an adaptive one
+  bool _suspectedDead {false}; // only informational, ignored when deserializing
 
 public:
   DataConfig() {}
-  DataConfig(const DataEntry& entry) : DataConfig(entry.id, entry.source, entry.subscribed, entry.writable) {}
+  DataConfig(const DataEntry& entry, const PollState* state) : DataConfig(entry.id, entry.source, entry.subscribed, entry.writable) {
+    if (state != nullptr) {
+      _pollIntervalS = state->fixedIntervalS;
+      _suspectedDead = state->isSuspectedDead();
+    }
+  }
   DataConfig(ValueId valueId, DeviceId source, bool subscribed, bool writable) :
     _valueId(valueId),
     _source(source),
@@ -40,6 +47,7 @@ public:
   const DeviceId& source() const { return _source; }
   bool subscribed() const { return _subscribed; }
   bool writable() const { return _writable; }
+  uint16_t pollInterval() const { return _pollIntervalS; }
 
   void serialize(jsons::IWriter& output) const {
     output.openObject();
@@ -47,6 +55,8 @@ public:
     output.property(F("source")).string(_source.toString());
     output.property(F("subscribed")).boolean(_subscribed);
     output.property(F("writable")).boolean(_writable);
+    output.property(F("pollInterval")).number(_pollIntervalS);
+    output.property(F("suspectedDead")).boolean(_suspectedDead);
     output.close();
   }
 
@@ -67,6 +77,14 @@ public:
           _subscribed = property.asBoolean().get();
         } else if (property.name() == "writable" && property.type() == jsons::ValueType::Boolean) {
           _writable = property.asBoolean().get();
+        } else if (property.name() == "pollInterval" && property.type() == jsons::ValueType::Integer) {
+          int32_t pollIntervalS = property.asInteger().get();
+          if (pollIntervalS < 0 || pollIntervalS > UINT16_MAX) {
+            return false;
+          }
+          _pollIntervalS = pollIntervalS;
+        } else if (property.name() == "suspectedDead" && property.type() == jsons::ValueType::Boolean) {
+          // read-only, accepted so that a configuration can be sent back as retrieved
         } else {
           return false;
         }
@@ -148,7 +166,7 @@ private:
       DataConfig config;
       if (config.deserialize(value)) {
         if (config.subscribed()) {
-          _access.addSubscription({config.source(), config.valueId()});
+          _access.addSubscription({config.source(), config.valueId()}, config.pollInterval());
         } else {
           _access.removeSubscription({config.source(), config.valueId()});
         }
@@ -194,9 +212,9 @@ private:
     auto writer = jsons::makeWriter(body);
 
     writer.openList();
-    for (auto& data : collectionData) {
-      if (data.second.isConfigured()) {
-        DataConfig{data.second}.serialize(writer);
+    for (auto& entry : collectionData) {
+      if (entry.isConfigured()) {
+        DataConfig{entry, _access.getPollState({entry.source, entry.id})}.serialize(writer);
       }
     }
     writer.close();
@@ -279,7 +297,7 @@ private:
         .sendSingleBody().write(request.body().content());
     } else {
       if (config.subscribed()) {
-        _access.addSubscription(key);
+        _access.addSubscription(key, config.pollInterval());
       } else {
         _access.removeSubscription(key);
       }
@@ -454,30 +472,30 @@ private:
     size_t i = 0u;
     DeviceType type;
     DeviceAddress address;
-    for (auto& data : collectionData) {
-      if (data.second.lastUpdate >= updatedSince && (!predicate || predicate(data.second))) {
+    for (auto& entry : collectionData) {
+      if (entry.lastUpdate >= updatedSince && (!predicate || predicate(entry))) {
         if (i == 0) {
-          type = data.first.first.type;
-          address = data.first.first.address;
+          type = entry.source.type;
+          address = entry.source.address;
           writer.property(deviceTypeToString(type)).openObject();
           writer.property(toolbox::convert<DeviceAddress>::toString(address, 10)).openObject();
         } else {
-          if (type != data.first.first.type) {
+          if (type != entry.source.type) {
             writer.close();
             writer.close();
-            type = data.first.first.type;
-            address = data.first.first.address;
+            type = entry.source.type;
+            address = entry.source.address;
             writer.property(deviceTypeToString(type)).openObject();
             writer.property(toolbox::convert<DeviceAddress>::toString(address, 10)).openObject();
-          } else if (address != data.first.first.address) {
+          } else if (address != entry.source.address) {
             writer.close();
-            address = data.first.first.address;
+            address = entry.source.address;
             writer.property(toolbox::convert<DeviceAddress>::toString(address, 10)).openObject();
           }
         }
 
-        writer.property(toolbox::convert<ValueId>::toString(data.second.id, 10));
-        serializer::serialize(writer, _conversionService, _definitions, data.second, false, numbersAsDecimals);
+        writer.property(toolbox::convert<ValueId>::toString(entry.id, 10));
+        serializer::serialize(writer, _conversionService, _definitions, _access, entry, false, numbersAsDecimals);
 
         ++i;
 
@@ -0,0 +1,299 @@
+#ifndef DATAHISTORY_H_
+#define DATAHISTORY_H_
+
+#include <iot_core/Interfaces.h>
+#include <iot_core/Utils.h>
+#include <functional>
+#include <vector>
+#include <new>
+#include "DataAccess.h"
+
+struct HistorySample {
+  unsigned long timeMs; // millis() when the value was received (with a resolution of seconds)
+  uint16_t rawValue;
+};
+
+/**
+ * Time series of a single value, stored in a ring of bytes.
+ *
+ * The oldest sample is kept in the header, each following sample is stored as
+ * a record of two varints: the seconds since the previous sample and the
+ * zigzag-encoded change of the raw value. Most records therefore take 2-3
+ * bytes. Appending to a full ring drops as many of the oldest samples as needed.
+ */
+class HistorySeries final {
+public:
+  static constexpr size_t MAX_RECORD_SIZE = 8; // 5 bytes for the seconds + 3 bytes for the change
+
+private:
+  DataStore::Key _key;
+  uint8_t* _ring;
+  uint16_t _capacity;
+  uint16_t _start = 0; // offset of the record following the oldest sample
+  uint16_t _used = 0;
+  uint16_t _samples = 0;
+  uint16_t _oldestValue = 0;
+  uint16_t _newestValue = 0;
+  uint32_t _spanS = 0; // from the oldest to the newest sample
+  unsigned long _newestMs = 0;
+
+public:
+  HistorySeries(DataStore::Key const& key, uint8_t* ring, uint16_t capacity) : _key(key), _ring(ring), _capacity(capacity) {}
+
+  DataStore::Key const& key() const { return _key; }
+  uint16_t samples() const { return _samples; }
+  uint16_t used() const { return _used; }
+
+  void reset(DataStore::Key const& key) {
+    _key = key;
+    _start = 0;
+    _used = 0;
+    _samples = 0;
+    _spanS = 0;
+  }
+
+  void append(uint16_t rawValue, unsigned long timeMs) {
+    if (_samples == 0) {
+      _oldestValue = rawValue;
+      _newestValue = rawValue;
+      _newestMs = timeMs;
+      _samples = 1;
+      return;
+    }
+
+    uint32_t deltaS = (timeMs - _newestMs) / 1000u;
+    int16_t change = static_cast<int16_t>(rawValue - _newestValue);
+    uint8_t record[MAX_RECORD_SIZE];
+    size_t size = writeVarint(record, deltaS);
+    size += writeVarint(record + size, static_cast<uint16_t>((static_cast<uint16_t>(change) << 1) ^ static_cast<uint16_t>(change >> 15)));
+
+    while (static_cast<size_t>(_capacity - _used) < size) {
+      dropOldest();
+    }
+    for (size_t i = 0; i < size; ++i) {
+      _ring[(_start + _used + i) % _capacity] = record[i];
+    }
+    _used += size;
+    _samples += 1;
+    _spanS += deltaS;
+    _newestMs += deltaS * 1000u; // keep the rounding error from adding up
+    _newestValue = rawValue;
+  }
+
+  /**
+   * Pass all samples to the consumer, oldest first.
+   */
+  void forEach(std::function<void(HistorySample const&)> consumer) const {
+    if (_samples == 0) {
+      return;
+    }
+    HistorySample sample { _newestMs - _spanS * 1000u, _oldestValue };
+    consumer(sample);
+    uint16_t offset = _start;
+    for (uint16_t i = 1; i < _samples; ++i) {
+      uint32_t deltaS;
+      uint32_t change;
+      offset = readVarint(offset, deltaS);
+      offset = readVarint(offset, change);
+      sample.timeMs += deltaS * 1000u;
+      sample.rawValue += static_cast<uint16_t>((change >> 1) ^ -(change & 1u));
+      consumer(sample);
+    }
+  }
+
+private:
+  void dropOldest() {
+    uint32_t deltaS;
+    uint32_t change;
+    uint16_t offset = readVarint(_start, deltaS);
+    offset = readVarint(offset, change);
+    _oldestValue += static_cast<uint16_t>((change >> 1) ^ -(change & 1u));
+    _spanS -= deltaS;
+    _used -= (offset + _capacity - _start) % _capacity;
+    _start = offset;
+    _samples -= 1;
+  }
+
+  static size_t writeVarint(uint8_t* bytes, uint32_t value) {
+    size_t size = 0;
+    while (value >= 0x80u) {
+      bytes[size++] = (value & 0x7Fu) | 0x80u;
+      value >>= 7;
+    }
+    bytes[size++] = value;
+    return size;
+  }
+
+  uint16_t readVarint(uint16_t offset, uint32_t& value) const {
+    value = 0;
+    uint8_t shift = 0;
+    uint8_t byte;
+    do {
+      byte = _ring[offset];
+      offset = (offset + 1) % _capacity;
+      value |= static_cast<uint32_t>(byte & 0x7Fu) << shift;
+      shift += 7;
+    } while ((byte & 0x80u) != 0);
+    return offset;
+  }
+};
+
+/**
+ * Short-term history of subscribed values in RAM.
+ *
+ * All series share one buffer allocated for the configured budget (0 disables
+ * the history), which is split into rings of the configured size. A value
+ * gets a ring with its first update, as long as there is one left. Rings of
+ * values which are no longer subscribed are reused.
+ *
+ * The history records the updates passed on by DataAccess, i.e. it follows
+ * the notification policy of the value definitions.
+ */
+class DataHistory final : public iot_core::IApplicationComponent {
+public:
+  static constexpr uint16_t DEFAULT_BUDGET = 0; // bytes
+  static constexpr uint16_t MAX_BUDGET = 32768; // bytes
+  static constexpr uint16_t DEFAULT_SERIES_SIZE = 128; // bytes
+
+private:
+  iot_core::Logger _logger;
+  iot_core::ISystem& _system;
+  DataAccess& _access;
+  uint16_t _budget = DEFAULT_BUDGET;
+  uint16_t _seriesSize = DEFAULT_SERIES_SIZE;
+  uint8_t* _buffer = nullptr;
+  size_t _maxSeries = 0;
+  std::vector<HistorySeries> _series {};
+  uint32_t _unrecorded = 0; // updates of values for which no ring was left
+
+public:
+  DataHistory(iot_core::ISystem& system, DataAccess& access)
+    : _logger(system.logger("hst")),
+    _system(system),
+    _access(access) {}
+
+  ~DataHistory() {
+    delete[] _buffer;
+  }
+
+  const char* name() const override {
+    return "hst";
+  }
+
+  const char* description() const override {
+    return "Data History";
+  }
+
+  bool configure(const char* name, const char* value) override {
+    if (strcmp(name, "budget") == 0) return setBudget(toolbox::convert<uint16_t>::fromString(value, nullptr, 10).otherwise(DEFAULT_BUDGET));
+    if (strcmp(name, "series") == 0) return setSeriesSize(toolbox::convert<uint16_t>::fromString(value, nullptr, 10).otherwise(DEFAULT_SERIES_SIZE));
+    return false;
+  }
+
+  void getConfig(std::function<void(const char*, const char*)> writer) const override {
+    writer("budget", toolbox::convert<uint16_t>::toString(_budget, 10).cstr());
+    writer("series", toolbox::convert<uint16_t>::toString(_seriesSize, 10).cstr());
+  }
+
+  bool setBudget(uint16_t budget) {
+    _budget = std::min(budget, MAX_BUDGET);
+    allocate();
+    return true;
+  }
+
+  bool setSeriesSize(uint16_t size) {
+    _seriesSize = std::max<uint16_t>(size, HistorySeries::MAX_RECORD_SIZE);
+    allocate();
+    return true;
+  }
+
+  void setup(bool /*connected*/) override {
+    _access.onUpdate([this] (DataEntry const& entry) { record(entry); });
+  }
+
+  void loop(iot_core::ConnectionStatus /*status*/) override {
+  }
+
+  void getDiagnostics(iot_core::IDiagnosticsCollector& collector) const override {
+    size_t samples = 0;
+    size_t used = 0;
+    for (auto& series : _series) {
+      samples += series.samples();
+      used += series.used();
+    }
+    // history: <series>/<max. series> <samples> <bytes used>/<bytes allocated> B
+    collector.addValue("history", toolbox::format(F("%u/%u %u %u/%u B"), _series.size(), _maxSeries, samples, used, _maxSeries * _seriesSize));
+    collector.addValue("unrecorded", toolbox::convert<uint32_t>::toString(_unrecorded, 10));
+  }
+
+  const HistorySeries* get(DataStore::Key const& key) const {
+    for (auto& series : _series) {
+      if (series.key() == key) {
+        return &series;
+      }
+    }
+    return nullptr;
+  }
+
+private:
+  void allocate() {
+    _series.clear();
+    delete[] _buffer;
+    _buffer = nullptr;
+    _maxSeries = _budget / (_seriesSize + sizeof(HistorySeries));
+    if (_maxSeries == 0) {
+      _logger.log(F("History disabled."));
+      return;
+    }
+
+    _buffer = new (std::nothrow) uint8_t[_maxSeries * _seriesSize];
+    if (_buffer == nullptr) {
+      _maxSeries = 0;
+      _logger.log(iot_core::LogLevel::Warning, toolbox::format(F("Failed to allocate history of %u bytes."), _budget));
+      return;
+    }
+    _series.reserve(_maxSeries);
+    _logger.log(toolbox::format(F("Using history for up to %u values of %u bytes."), _maxSeries, _seriesSize));
+  }
+
+  void record(DataEntry const& entry) {
+    if (!entry.subscribed || _maxSeries == 0) {
+      return;
+    }
+
+    DataStore::Key key {entry.source, entry.id};
+    HistorySeries* series = obtain(key);
+    if (series == nullptr) {
+      _unrecorded += 1;
+      return;
+    }
+    series->append(entry.rawValue, entry.lastUpdateMs);
+  }
+
+  HistorySeries* obtain(DataStore::Key const& key) {
+    HistorySeries* unused = nullptr;
+    for (auto& series : _series) {
+      if (series.key() == key) {
+        return &series;
+      }
+      if (unused == nullptr) {
+        const DataEntry* entry = _access.getEntry(series.key());
+        if (entry == nullptr || !entry->subscribed) {
+          unused = &series;
+        }
+      }
+    }
+
+    if (_series.size() < _maxSeries) {
+      _series.emplace_back(key, _buffer + _series.size() * _seriesSize, _seriesSize);
+      return &_series.back();
+    }
+
+    if (unused != nullptr) {
+      unused->reset(key);
+    }
+    return unused;
+  }
+};
+
+#endif
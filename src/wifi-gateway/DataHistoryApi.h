@@ -0,0 +1,181 @@
+#ifndef DATAHISTORYAPI_H_
+#define DATAHISTORYAPI_H_
+
+#include <iot_core/api/Interfaces.h>
+#include <uri/UriBraces.h>
+#include <jsons.h>
+#include "DataHistory.h"
+#include "DataLog.h"
+#include "ValueConversion.h"
+
+static const char ARG_HISTORY_FROM[] = "from";
+static const char ARG_HISTORY_TO[] = "to";
+static const char ARG_HISTORY_PERSISTED[] = "persisted";
+
+/**
+ * Provides the history of a subscribed value from RAM or from the persisted
+ * log, optionally limited to a time range.
+ */
+class DataHistoryApi final : public iot_core::api::IProvider {
+private:
+  iot_core::Logger _logger;
+  iot_core::ISystem& _system;
+  const DataHistory& _history;
+  const DataLog& _log;
+  DataAccess& _access;
+  IConversionService& _conversionService;
+
+public:
+  DataHistoryApi(iot_core::ISystem& system, const DataHistory& history, const DataLog& log, DataAccess& access, IConversionService& conversionService)
+  : _logger(system.logger("api")), _system(system), _history(history), _log(log), _access(access), _conversionService(conversionService) {}
+
+  void setupApi(iot_core::api::IServer& server) override {
+    server.on(UriBraces(F("/api/data/{}/{}/{}/history")), iot_core::api::HttpMethod::GET, [this](iot_core::api::IRequest& request, iot_core::api::IResponse& response) {
+      getHistory(request, response);
+    });
+  }
+
+private:
+  void getHistory(iot_core::api::IRequest& request, iot_core::api::IResponse& response) {
+    DeviceType type = deviceTypeFromString(request.pathArg(0));
+    if (type == DeviceType::Any) {
+      response
+        .code(iot_core::api::ResponseCode::BadRequest)
+        .contentType(iot_core::api::ContentType::TextPlain)
+        .sendSingleBody().write(F("device type invalid"));
+      return;
+    }
+
+    toolbox::strref addressArg = request.pathArg(1);
+    toolbox::Maybe<uint8_t> addressNumber = toolbox::convert<uint8_t>::fromString(addressArg, nullptr, 10);
+    if (!addressNumber || addressNumber.get() > 0x7F) {
+      response
+        .code(iot_core::api::ResponseCode::BadRequest)
+        .contentType(iot_core::api::ContentType::TextPlain)
+        .sendSingleBody().write(F("device address invalid"));
+      return;
+    }
+
+    toolbox::strref valueIdArg = request.pathArg(2);
+    toolbox::Maybe<uint16_t> valueIdNumber = toolbox::convert<uint16_t>::fromString(valueIdArg, nullptr, 10);
+    if (!valueIdNumber) {
+      response
+        .code(iot_core::api::ResponseCode::BadRequest)
+        .contentType(iot_core::api::ContentType::TextPlain)
+        .sendSingleBody().write(F("value ID invalid"));
+      return;
+    }
+
+    const DataAccess::DataKey key {DeviceId{type, DeviceAddress(addressNumber.get())}, ValueId(valueIdNumber.get())};
+
+    if (request.hasArg(ARG_HISTORY_PERSISTED)) {
+      getPersistedHistory(request, response, key);
+      return;
+    }
+
+    const HistorySeries* series = _history.get(key);
+    if (series == nullptr) {
+      response
+        .code(iot_core::api::ResponseCode::NotFound)
+        .contentType(iot_core::api::ContentType::TextPlain)
+        .sendSingleBody().write(F("No history recorded for this value."));
+      return;
+    }
+
+    iot_core::DateTime from;
+    iot_core::DateTime to;
+    if (request.hasArg(ARG_HISTORY_FROM)) {
+      from.fromString(request.arg(ARG_HISTORY_FROM).cstr());
+    }
+    if (request.hasArg(ARG_HISTORY_TO)) {
+      to.fromString(request.arg(ARG_HISTORY_TO).cstr());
+    }
+
+    auto& body = response
+      .code(iot_core::api::ResponseCode::Ok)
+      .contentType(iot_core::api::ContentType::ApplicationJson)
+      .sendChunkedBody();
+
+    if (!body.valid()) {
+      return;
+    }
+
+    auto writer = jsons::makeWriter(body);
+
+    iot_core::DateTime now = _access.currentDateTime();
+    unsigned long currentMs = millis();
+
+    writer.openObject();
+    writer.property(F("retrievedOn")).string(now.toString());
+    writer.property(F("id")).number(key.second);
+    writer.property(F("source")).string(key.first.toString());
+    writer.property(F("samples"));
+    writer.openList();
+    series->forEach([&] (HistorySample const& sample) {
+      iot_core::DateTime time = backdate(now, currentMs - sample.timeMs);
+      if (time >= from && (!to.isSet() || to >= time)) {
+        writer.openObject();
+        writer.property(F("time")).string(time.toString());
+        writer.property(F("rawValue")).string(getRawValueAsHexString(sample.rawValue));
+        writer.property(F("value"));
+        _conversionService.toJson(writer, key.second, sample.rawValue);
+        writer.close();
+      }
+      _system.lyield();
+    });
+    writer.close();
+    writer.close();
+
+    writer.end();
+  }
+
+  void getPersistedHistory(iot_core::api::IRequest& request, iot_core::api::IResponse& response, DataAccess::DataKey const& key) {
+    uint32_t fromS = 0;
+    uint32_t toS = UINT32_MAX;
+    if (request.hasArg(ARG_HISTORY_FROM)) {
+      iot_core::DateTime from;
+      from.fromString(request.arg(ARG_HISTORY_FROM).cstr());
+      fromS = from.isSet() ? toEpochSeconds(from) : fromS;
+    }
+    if (request.hasArg(ARG_HISTORY_TO)) {
+      iot_core::DateTime to;
+      to.fromString(request.arg(ARG_HISTORY_TO).cstr());
+      toS = to.isSet() ? toEpochSeconds(to) : toS;
+    }
+
+    auto& body = response
+      .code(iot_core::api::ResponseCode::Ok)
+      .contentType(iot_core::api::ContentType::ApplicationJson)
+      .sendChunkedBody();
+
+    if (!body.valid()) {
+      return;
+    }
+
+    auto writer = jsons::makeWriter(body);
+
+    writer.openObject();
+    writer.property(F("retrievedOn")).string(_access.currentDateTime().toString());
+    writer.property(F("id")).number(key.second);
+    writer.property(F("source")).string(key.first.toString());
+    writer.property(F("samples"));
+    writer.openList();
+    _log.forEach(key, fromS, toS, [&] (LogRecord const& record, uint16_t resolutionS) {
+      writer.openObject();
+      writer.property(F("time")).string(formatEpochSeconds(record.timeS));
+      writer.property(F("rawValue")).string(getRawValueAsHexString(record.rawValue));
+      writer.property(F("value"));
+      _conversionService.toJson(writer, key.second, record.rawValue);
+      if (resolutionS != 0) {
+        writer.property(F("resolution")).number(resolutionS);
+      }
+      writer.close();
+    });
+    writer.close();
+    writer.close();
+
+    writer.end();
+  }
+};
+
+#endif
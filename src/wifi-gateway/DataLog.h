@@ -0,0 +1,544 @@
+#ifndef DATALOG_H_
+#define DATALOG_H_
+
+#include <iot_core/Interfaces.h>
+#include <iot_core/DateTime.h>
+#include <iot_core/Utils.h>
+#include <LittleFS.h>
+#include <functional>
+#include <vector>
+#include <algorithm>
+#include "DataAccess.h"
+#include "ValueDefinitions.h"
+
+static const char DATA_LOG_FILE_HEADER[] = "~L1.0";
+static const char DATA_LOG_TEMP_FILE[] = "/log/tmp";
+
+/**
+ * Seconds since 1970-01-01 (local time) of the given date/time.
+ */
+uint32_t toEpochSeconds(iot_core::DateTime const& dateTime) {
+  // days from civil, see http://howardhinnant.github.io/date_algorithms.html
+  int32_t year = dateTime.year - (dateTime.month <= 2 ? 1 : 0);
+  int32_t era = year / 400;
+  uint32_t yearOfEra = year - era * 400;
+  uint32_t dayOfYear = (153 * (dateTime.month + (dateTime.month > 2 ? -3 : 9)) + 2) / 5 + dateTime.day - 1;
+  uint32_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  uint32_t days = era * 146097 + dayOfEra - 719468;
+  return ((days * 24ul + dateTime.hour) * 60ul + dateTime.minute) * 60ul + dateTime.second;
+}
+
+/**
+ * Formats seconds since 1970-01-01 like iot_core::DateTime::toString().
+ */
+const char* formatEpochSeconds(uint32_t epochS) {
+  static char buffer[32]; // "2024-01-11T20:12:15.000"
+  // civil from days, see http://howardhinnant.github.io/date_algorithms.html
+  uint32_t days = epochS / 86400ul + 719468;
+  uint32_t secondOfDay = epochS % 86400ul;
+  uint32_t era = days / 146097;
+  uint32_t dayOfEra = days - era * 146097;
+  uint32_t yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+  uint32_t dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+  uint32_t monthIndex = (5 * dayOfYear + 2) / 153;
+  uint32_t day = dayOfYear - (153 * monthIndex + 2) / 5 + 1;
+  uint32_t month = monthIndex < 10 ? monthIndex + 3 : monthIndex - 9;
+  uint32_t year = yearOfEra + era * 400 + (month <= 2 ? 1 : 0);
+  snprintf(buffer, sizeof(buffer), "%04u-%02u-%02uT%02u:%02u:%02u.000", static_cast<uint16_t>(year), static_cast<uint8_t>(month), static_cast<uint8_t>(day), static_cast<uint8_t>(secondOfDay / 3600u), static_cast<uint8_t>((secondOfDay / 60u) % 60u), static_cast<uint8_t>(secondOfDay % 60u));
+  return buffer;
+}
+
+struct LogRecord {
+  static constexpr size_t SIZE = 10; // bytes in a segment
+
+  uint32_t timeS; // see toEpochSeconds()
+  DeviceId source;
+  ValueId id;
+  uint16_t rawValue;
+
+  void write(uint8_t* bytes) const {
+    bytes[0] = timeS >> 24;
+    bytes[1] = (timeS >> 16) & 0xFFu;
+    bytes[2] = (timeS >> 8) & 0xFFu;
+    bytes[3] = timeS & 0xFFu;
+    bytes[4] = static_cast<uint8_t>(source.type);
+    bytes[5] = source.address;
+    bytes[6] = id >> 8;
+    bytes[7] = id & 0xFFu;
+    bytes[8] = rawValue >> 8;
+    bytes[9] = rawValue & 0xFFu;
+  }
+
+  void read(const uint8_t* bytes) {
+    timeS = (static_cast<uint32_t>(bytes[0]) << 24) | (static_cast<uint32_t>(bytes[1]) << 16) | (bytes[2] << 8) | bytes[3];
+    source = DeviceId{DeviceType(bytes[4]), bytes[5]};
+    id = (bytes[6] << 8) | bytes[7];
+    rawValue = (bytes[8] << 8) | bytes[9];
+  }
+};
+
+/**
+ * Append-only log of the updates of subscribed values on LittleFS, to keep
+ * days of data across reboots and longer network outages.
+ *
+ * Updates are collected in RAM and appended to the current segment file in
+ * batches, either when a batch is full or after the flush interval, to keep
+ * the number of flash writes low. Segments are files of at most SEGMENT_SIZE
+ * bytes with fixed-size records. When the log exceeds its budget or the file
+ * system runs low on space, the oldest segment with full resolution is
+ * downsampled to averages over COMPACTED_RESOLUTION_S (or the last value, for
+ * values without a unit or without any value which could be decoded). If there
+ * is none left, the oldest segment is removed.
+ *
+ * LittleFS takes at least one block per file, so the size of a segment counts
+ * in whole blocks against the budget. Downsampled records are therefore
+ * appended to the newest compacted segment (as long as it is smaller than
+ * SEGMENT_SIZE) instead of leaving a small file per compacted segment.
+ *
+ * loop() does at most one step (a batch or a slice of a compaction) per call,
+ * so the log never blocks for long. Like the RAM history, the log records the
+ * updates passed on by DataAccess, i.e. it follows the notification policy.
+ */
+class DataLog final : public iot_core::IApplicationComponent {
+public:
+  static constexpr uint16_t DEFAULT_BUDGET_KB = 0;
+  static constexpr uint16_t DEFAULT_FLUSH_INTERVAL_S = 300;
+  static constexpr size_t SEGMENT_SIZE = 8192; // bytes
+  static constexpr size_t BATCH_SIZE = 64; // records
+  static constexpr size_t MAX_PENDING = 2 * BATCH_SIZE; // records
+  static constexpr size_t MIN_FREE_SPACE = 32768; // bytes left on the file system
+  static constexpr uint16_t COMPACTED_RESOLUTION_S = 900;
+  static constexpr size_t COMPACTION_STEP = 64; // records per loop()
+  static constexpr uint32_t DEFAULT_BLOCK_SIZE = 4096; // bytes, if the file system does not tell
+
+private:
+  struct Segment {
+    uint32_t number;
+    uint16_t resolutionS; // 0 = every update
+    uint32_t size;
+  };
+
+  struct Bucket {
+    DataStore::Key key;
+    uint32_t startS;
+    int32_t sum; // of the decoded values
+    uint16_t count; // decoded values in the sum
+    uint16_t lastValue; // raw
+  };
+
+  iot_core::Logger _logger;
+  iot_core::ISystem& _system;
+  DataAccess& _access;
+  const IConversionService& _conversion;
+  const IDefinitionRepository& _definitions;
+  uint16_t _budgetKb = DEFAULT_BUDGET_KB;
+  uint16_t _flushIntervalS = DEFAULT_FLUSH_INTERVAL_S;
+  uint32_t _blockSize = DEFAULT_BLOCK_SIZE;
+
+  std::vector<Segment> _segments {}; // ordered by number, i.e. oldest first
+  std::vector<LogRecord> _pending {};
+  unsigned long _lastFlushMs = 0;
+  bool _checkSpace = true;
+  uint32_t _dropped = 0;
+
+  bool _compacting = false;
+  bool _compactionFailed = false; // writing the compacted segment failed, remove the oldest segment instead
+  uint32_t _compactedSegment = 0;
+  bool _merging = false; // whether the compacted records are appended to _mergedSegment
+  uint32_t _mergedSegment = 0;
+  File _compactionInput {};
+  File _compactionOutput {};
+  std::vector<Bucket> _buckets {};
+
+public:
+  DataLog(iot_core::ISystem& system, DataAccess& access, const IConversionService& conversion, const IDefinitionRepository& definitions)
+    : _logger(system.logger("dlg")),
+    _system(system),
+    _access(access),
+    _conversion(conversion),
+    _definitions(definitions) {}
+
+  const char* name() const override {
+    return "dlg";
+  }
+
+  const char* description() const override {
+    return "Data Log";
+  }
+
+  bool configure(const char* name, const char* value) override {
+    if (strcmp(name, "budget") == 0) return setBudget(toolbox::convert<uint16_t>::fromString(value, nullptr, 10).otherwise(DEFAULT_BUDGET_KB));
+    if (strcmp(name, "flush") == 0) return setFlushInterval(toolbox::convert<uint16_t>::fromString(value, nullptr, 10).otherwise(DEFAULT_FLUSH_INTERVAL_S));
+    return false;
+  }
+
+  void getConfig(std::function<void(const char*, const char*)> writer) const override {
+    writer("budget", toolbox::convert<uint16_t>::toString(_budgetKb, 10).cstr());
+    writer("flush", toolbox::convert<uint16_t>::toString(_flushIntervalS, 10).cstr());
+  }
+
+  bool setBudget(uint16_t budgetKb) {
+    _budgetKb = budgetKb;
+    _checkSpace = true;
+    _logger.log(toolbox::format(F("Using budget of %u KB."), _budgetKb));
+    return true;
+  }
+
+  bool setFlushInterval(uint16_t intervalS) {
+    _flushIntervalS = std::max<uint16_t>(intervalS, 10u);
+    _logger.log(toolbox::format(F("Using flush interval of %u s."), _flushIntervalS));
+    return true;
+  }
+
+  void setup(bool /*connected*/) override {
+    LittleFS.remove(DATA_LOG_TEMP_FILE); // left over from an interrupted compaction, the original segment is still in place
+    restoreSegments();
+    _access.onUpdate([this] (DataEntry const& entry) { record(entry); });
+  }
+
+  void loop(iot_core::ConnectionStatus /*status*/) override {
+    if (_pending.size() >= BATCH_SIZE || (!_pending.empty() && millis() - _lastFlushMs >= _flushIntervalS * 1000ul)) {
+      flush();
+    } else if (_compacting) {
+      compactionStep();
+    } else if (_checkSpace) {
+      ensureSpace();
+    }
+  }
+
+  void getDiagnostics(iot_core::IDiagnosticsCollector& collector) const override {
+    // log: <segments> <bytes on flash> B <pending records> <dropped records>
+    collector.addValue("log", toolbox::format(F("%u %u B %u %u"), _segments.size(), totalSize(), _pending.size(), _dropped));
+    collector.addValue("compacting", toolbox::convert<bool>::toString(_compacting));
+  }
+
+  /**
+   * Pass the records of the given value within the given time range to the
+   * consumer, oldest first, including the ones not written yet. The second
+   * argument is the resolution of the record (0 if not downsampled).
+   */
+  void forEach(DataStore::Key const& key, uint32_t fromS, uint32_t toS, std::function<void(LogRecord const&, uint16_t)> consumer) const {
+    uint8_t bytes[LogRecord::SIZE];
+    LogRecord record;
+    for (auto& segment : _segments) {
+      auto file = LittleFS.open(segmentPath(segment.number), "r");
+      if (!file) {
+        continue;
+      }
+      file.seek(sizeof(DATA_LOG_FILE_HEADER) - 1 + 2);
+      while (file.read(bytes, LogRecord::SIZE) == LogRecord::SIZE) {
+        record.read(bytes);
+        if (record.source == key.first && record.id == key.second && record.timeS >= fromS && record.timeS <= toS) {
+          consumer(record, segment.resolutionS);
+        }
+        _system.lyield();
+      }
+      file.close();
+    }
+    for (auto& pending : _pending) {
+      if (pending.source == key.first && pending.id == key.second && pending.timeS >= fromS && pending.timeS <= toS) {
+        consumer(pending, 0);
+      }
+    }
+  }
+
+private:
+  static const char* segmentPath(uint32_t number) {
+    static char path[16]; // "/log/FFFFFFFF"
+    snprintf(path, sizeof(path), "/log/%08X", number);
+    return path;
+  }
+
+  size_t budget() const {
+    return _budgetKb * 1024ul;
+  }
+
+  /**
+   * Flash used by the segments, in whole blocks.
+   */
+  size_t totalSize() const {
+    size_t size = 0;
+    for (auto& segment : _segments) {
+      size += (segment.size + _blockSize - 1) / _blockSize * _blockSize;
+    }
+    return size;
+  }
+
+  void record(DataEntry const& entry) {
+    if (!entry.subscribed || _budgetKb == 0 || !entry.lastUpdate.isSet()) {
+      return;
+    }
+
+    if (_pending.size() >= MAX_PENDING) {
+      _dropped += 1;
+      return;
+    }
+
+    if (_pending.empty()) {
+      _lastFlushMs = millis(); // the flush interval is the maximum time an update is held back
+    }
+    _pending.push_back({toEpochSeconds(entry.lastUpdate), entry.source, entry.id, entry.rawValue});
+  }
+
+  void restoreSegments() {
+    FSInfo info;
+    if (LittleFS.info(info) && info.blockSize > 0) {
+      _blockSize = info.blockSize;
+    }
+
+    size_t headerSize = sizeof(DATA_LOG_FILE_HEADER) - 1 + 2;
+    _segments.clear();
+    Dir dir = LittleFS.openDir("/log");
+    while (dir.next()) {
+      uint32_t number = strtoul(dir.fileName().c_str(), nullptr, 16);
+      auto file = dir.openFile("r");
+      char header[6] = {0};
+      uint8_t resolution[2] = {0};
+      if (file.readBytes(header, 5) == 5 && strcmp(header, DATA_LOG_FILE_HEADER) == 0 && file.read(resolution, 2) == 2) {
+        uint32_t size = dir.fileSize();
+        if ((size - headerSize) % LogRecord::SIZE != 0) {
+          size = SEGMENT_SIZE; // ends with a partially written record, so do not append to it
+        }
+        _segments.push_back({number, static_cast<uint16_t>((resolution[0] << 8) | resolution[1]), size});
+      }
+      file.close();
+      _system.lyield();
+    }
+    std::sort(_segments.begin(), _segments.end(), [] (Segment const& a, Segment const& b) { return a.number < b.number; });
+    _logger.log(iot_core::LogLevel::Info, toolbox::format(F("Found %u log segments with %u bytes."), _segments.size(), totalSize()));
+  }
+
+  static bool writeHeader(File& file, uint16_t resolutionS) {
+    uint8_t resolution[2] = { resolutionS >> 8, resolutionS & 0xFFu };
+    return file.write(DATA_LOG_FILE_HEADER) == sizeof(DATA_LOG_FILE_HEADER) - 1 && file.write(resolution, 2) == 2;
+  }
+
+  /**
+   * Append the pending records to the current segment with a single write.
+   */
+  void flush() {
+    size_t headerSize = sizeof(DATA_LOG_FILE_HEADER) - 1 + 2;
+    size_t batchSize = std::min(_pending.size(), BATCH_SIZE);
+    if (_segments.empty() || _segments.back().resolutionS != 0 || _segments.back().size + batchSize * LogRecord::SIZE > SEGMENT_SIZE) {
+      uint32_t number = _segments.empty() ? 0 : _segments.back().number + 1;
+      auto file = LittleFS.open(segmentPath(number), "w");
+      if (!file || !writeHeader(file, 0)) {
+        _logger.log(iot_core::LogLevel::Error, F("Failed to create log segment."));
+        _dropped += _pending.size();
+        _pending.clear();
+        return;
+      }
+      file.close();
+      _segments.push_back({number, 0, static_cast<uint32_t>(headerSize)});
+    }
+
+    uint8_t bytes[BATCH_SIZE * LogRecord::SIZE];
+    for (size_t i = 0; i < batchSize; ++i) {
+      _pending[i].write(bytes + i * LogRecord::SIZE);
+    }
+
+    Segment& segment = _segments.back();
+    auto file = LittleFS.open(segmentPath(segment.number), "a");
+    size_t written = file ? file.write(bytes, batchSize * LogRecord::SIZE) : 0;
+    file.close();
+    if (written != batchSize * LogRecord::SIZE) {
+      // A partially written record would misalign the following ones, so continue with a new segment
+      _logger.log(iot_core::LogLevel::Error, F("Failed to append to log segment."));
+      _dropped += batchSize - written / LogRecord::SIZE;
+      written = SEGMENT_SIZE;
+    }
+    segment.size += written;
+    _pending.erase(_pending.begin(), _pending.begin() + batchSize);
+    _lastFlushMs = millis();
+    _checkSpace = true;
+  }
+
+  bool lowOnSpace() const {
+    if (totalSize() > budget()) {
+      return true;
+    }
+    FSInfo info;
+    return LittleFS.info(info) && info.totalBytes - info.usedBytes < MIN_FREE_SPACE;
+  }
+
+  Segment* findSegment(uint32_t number) {
+    for (auto& segment : _segments) {
+      if (segment.number == number) {
+        return &segment;
+      }
+    }
+    return nullptr;
+  }
+
+  /**
+   * Downsample the oldest segment with full resolution or remove the oldest
+   * segment while over budget. The current (newest) segment is left alone.
+   */
+  void ensureSpace() {
+    _checkSpace = false;
+    if (_segments.size() < 2 || !lowOnSpace()) {
+      return;
+    }
+
+    for (size_t i = 0; i + 1 < _segments.size() && !_compactionFailed; ++i) {
+      if (_segments[i].resolutionS == 0) {
+        startCompaction(i);
+        return;
+      }
+    }
+
+    _logger.log(iot_core::LogLevel::Info, toolbox::format(F("Removing log segment %u."), _segments.front().number));
+    LittleFS.remove(segmentPath(_segments.front().number));
+    _segments.erase(_segments.begin());
+    _compactionFailed = false;
+    _checkSpace = true;
+  }
+
+  /**
+   * Start downsampling the given segment. All segments before it are already
+   * compacted, so if the one right before it still has room, the records are
+   * appended to a copy of it, which replaces it when done.
+   */
+  void startCompaction(size_t index) {
+    Segment const& segment = _segments[index];
+    _compactionFailed = false;
+    _merging = index > 0 && _segments[index - 1].resolutionS == COMPACTED_RESOLUTION_S && _segments[index - 1].size < SEGMENT_SIZE;
+    _mergedSegment = _merging ? _segments[index - 1].number : 0;
+    _compactionInput = LittleFS.open(segmentPath(segment.number), "r");
+    _compactionOutput = LittleFS.open(DATA_LOG_TEMP_FILE, "w");
+    if (!_compactionInput || !_compactionOutput || !(_merging ? copySegment(_mergedSegment, _compactionOutput) : writeHeader(_compactionOutput, COMPACTED_RESOLUTION_S))) {
+      _logger.log(iot_core::LogLevel::Error, toolbox::format(F("Failed to compact log segment %u."), segment.number));
+      _compactionInput.close();
+      _compactionOutput.close();
+      LittleFS.remove(DATA_LOG_TEMP_FILE);
+      _compactionFailed = true;
+      _checkSpace = true;
+      return;
+    }
+    _compactionInput.seek(sizeof(DATA_LOG_FILE_HEADER) - 1 + 2);
+    _buckets.clear();
+    _compacting = true;
+    _compactedSegment = segment.number;
+    _logger.log(iot_core::LogLevel::Info, toolbox::format(F("Compacting log segment %u."), segment.number));
+  }
+
+  bool copySegment(uint32_t number, File& output) {
+    auto input = LittleFS.open(segmentPath(number), "r");
+    if (!input) {
+      return false;
+    }
+    uint8_t bytes[256];
+    bool copied = true;
+    size_t length;
+    while (copied && (length = input.read(bytes, sizeof(bytes))) > 0) {
+      copied = output.write(bytes, length) == length;
+      _system.lyield();
+    }
+    input.close();
+    return copied;
+  }
+
+  void compactionStep() {
+    uint8_t bytes[LogRecord::SIZE];
+    LogRecord record;
+    for (size_t i = 0; i < COMPACTION_STEP; ++i) {
+      if (_compactionInput.read(bytes, LogRecord::SIZE) != LogRecord::SIZE) {
+        finishCompaction();
+        return;
+      }
+      record.read(bytes);
+      uint32_t startS = record.timeS - record.timeS % COMPACTED_RESOLUTION_S;
+      DataStore::Key key {record.source, record.id};
+      auto bucket = std::find_if(_buckets.begin(), _buckets.end(), [&key] (Bucket const& bucket) { return bucket.key == key; });
+      if (bucket == _buckets.end()) {
+        _buckets.push_back({key, startS, 0, 0, 0});
+        bucket = _buckets.end() - 1;
+      } else if (bucket->startS != startS) {
+        if (!writeBucket(*bucket)) {
+          finishCompaction();
+          return;
+        }
+        *bucket = {key, startS, 0, 0, 0};
+      }
+      auto value = _conversion.getConversion(record.id).codec().decode(record.rawValue);
+      if (value && record.rawValue != VALUE_NOT_AVAILABLE) {
+        bucket->sum += value.get();
+        bucket->count += 1;
+      }
+      bucket->lastValue = record.rawValue;
+    }
+  }
+
+  /**
+   * Append the bucket to the compacted segment. Failures are remembered, as
+   * the file system is likely to be full while compacting.
+   */
+  bool writeBucket(Bucket const& bucket) {
+    uint16_t rawValue = bucket.lastValue;
+    Unit unit = _definitions.get(bucket.key.second).unit;
+    if (unit != Unit::None && unit != Unit::Unknown && bucket.count > 0) {
+      auto average = _conversion.getConversion(bucket.key.second).codec().encode(static_cast<int32_t>(bucket.sum / static_cast<int32_t>(bucket.count)));
+      if (average) {
+        rawValue = average.get();
+      }
+    }
+    uint8_t bytes[LogRecord::SIZE];
+    LogRecord{bucket.startS, bucket.key.first, bucket.key.second, rawValue}.write(bytes);
+    if (_compactionOutput.write(bytes, LogRecord::SIZE) != LogRecord::SIZE) {
+      _compactionFailed = true;
+    }
+    return !_compactionFailed;
+  }
+
+  void finishCompaction() {
+    for (auto& bucket : _buckets) {
+      if (_compactionFailed) {
+        break;
+      }
+      writeBucket(bucket);
+    }
+    _buckets.clear();
+    _compactionInput.close();
+    _compactionOutput.close();
+    _compacting = false;
+    _checkSpace = true;
+
+    Segment* segment = findSegment(_compactedSegment);
+    Segment* target = _merging ? findSegment(_mergedSegment) : segment;
+    if (segment == nullptr || target == nullptr) {
+      LittleFS.remove(DATA_LOG_TEMP_FILE);
+      return;
+    }
+    if (_compactionFailed) {
+      // the compacted segment is incomplete, so keep the original one
+      _logger.log(iot_core::LogLevel::Error, toolbox::format(F("Failed to write compacted log segment %u."), segment->number));
+      LittleFS.remove(DATA_LOG_TEMP_FILE);
+      return;
+    }
+
+    auto file = LittleFS.open(DATA_LOG_TEMP_FILE, "r");
+    uint32_t size = file ? file.size() : 0;
+    file.close();
+    // LittleFS replaces an existing file atomically, so no segment is ever lost. If the
+    // records were merged, a reset before the original is removed leaves them in both resolutions.
+    if (size == 0 || !LittleFS.rename(DATA_LOG_TEMP_FILE, segmentPath(target->number))) {
+      _logger.log(iot_core::LogLevel::Error, toolbox::format(F("Failed to replace log segment %u."), target->number));
+      LittleFS.remove(DATA_LOG_TEMP_FILE);
+      _compactionFailed = true;
+      return;
+    }
+
+    if (_merging) {
+      _logger.log(iot_core::LogLevel::Info, toolbox::format(F("Compacted log segment %u from %u bytes into segment %u (now %u bytes)."), segment->number, segment->size, target->number, size));
+      target->size = size;
+      LittleFS.remove(segmentPath(segment->number));
+      _segments.erase(_segments.begin() + (segment - _segments.data()));
+    } else {
+      _logger.log(iot_core::LogLevel::Info, toolbox::format(F("Compacted log segment %u from %u to %u bytes."), segment->number, segment->size, size));
+      segment->resolutionS = COMPACTED_RESOLUTION_S;
+      segment->size = size;
+    }
+  }
+};
+
+#endif
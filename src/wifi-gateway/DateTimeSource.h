@@ -67,8 +67,10 @@ public:
 
   void setup(bool /*connected*/) override {
     _protocol.addDevice(this);
-    _protocol.onResponse([this] (ResponseData data) { processData(data.valueId, data.value); });
-    _protocol.onWrite([this] (WriteData data) { processData(data.valueId, data.value); });
+    _protocol.setAcceptedSources(name(), {_config.timeSourceId});
+    _protocol.addListener(name(),
+      MessageInterest().type(MessageType::Response).type(MessageType::Write).ids({ _config.dayId, _config.monthId, _config.yearId, _config.hourId, _config.minuteId }),
+      [this] (ProtocolMessage const& message) { processData(message.valueId, message.value, message.timestampMs); });
   }
 
   void loop(iot_core::ConnectionStatus /*status*/) override {
@@ -117,85 +119,76 @@ private:
     auto currentMs = millis();
     if (currentMs > (_lastRequestDateTimeFields + _requestDateTimeFieldIntervalMs)) {
       if (currentMs > _dateTimeFields.minute.lastUpdateMs + _dateTimeFieldAgeThresholdMs) {
-        _protocol.request({ deviceId(), _config.timeSourceId, _config.minuteId });
+        _protocol.request({ deviceId(), _config.timeSourceId, _config.minuteId }, TrafficClass::TimeSync);
       }
 
       if (currentMs > _dateTimeFields.hour.lastUpdateMs + _dateTimeFieldAgeThresholdMs) {
-        _protocol.request({ deviceId(), _config.timeSourceId, _config.hourId });
+        _protocol.request({ deviceId(), _config.timeSourceId, _config.hourId }, TrafficClass::TimeSync);
       }
 
       if (currentMs > _dateTimeFields.day.lastUpdateMs + _dateTimeFieldAgeThresholdMs) {
-        _protocol.request({ deviceId(), _config.timeSourceId, _config.dayId });
+        _protocol.request({ deviceId(), _config.timeSourceId, _config.dayId }, TrafficClass::TimeSync);
       }
 
       if (currentMs > _dateTimeFields.month.lastUpdateMs + _dateTimeFieldAgeThresholdMs) {
-        _protocol.request({ deviceId(), _config.timeSourceId, _config.monthId });
+        _protocol.request({ deviceId(), _config.timeSourceId, _config.monthId }, TrafficClass::TimeSync);
       }
 
       if (currentMs > _dateTimeFields.year.lastUpdateMs + _dateTimeFieldAgeThresholdMs) {
-        _protocol.request({ deviceId(), _config.timeSourceId, _config.yearId });
+        _protocol.request({ deviceId(), _config.timeSourceId, _config.yearId }, TrafficClass::TimeSync);
       }
 
       _lastRequestDateTimeFields = currentMs;
     }
   }
 
-  void processData(ValueId valueId, uint16_t value) {
-    if (isDateTimeField(valueId)) {
-      bool availableBefore = available();
-      updateDateTimeField(valueId, value);
-      if (!availableBefore && available()) {
-        _logger.log(iot_core::LogLevel::Info, toolbox::format(F("Date and time acquired: %s"), _currentDateTime.toString()));
-      }
+  void processData(ValueId valueId, uint16_t value, unsigned long timestampMs) {
+    // only called for the date/time fields, see the interest of the listener
+    bool availableBefore = available();
+    updateDateTimeField(valueId, value, timestampMs != 0 ? timestampMs : millis());
+    if (!availableBefore && available()) {
+      _logger.log(iot_core::LogLevel::Info, toolbox::format(F("Date and time acquired: %s"), _currentDateTime.toString()));
     }
   }
 
-  bool isDateTimeField(ValueId valueId) {
-    return valueId == _config.dayId
-        || valueId == _config.monthId
-        || valueId == _config.yearId
-        || valueId == _config.hourId
-        || valueId == _config.minuteId;
-  }
-
   toolbox::Maybe<int32_t> decode(ValueId id, uint16_t value) const {
     return _conversion.getConversion(id).codec().decode(value);
   }
 
-  void updateDateTimeField(ValueId valueId, uint16_t value) {
+  void updateDateTimeField(ValueId valueId, uint16_t value, unsigned long receivedMs) {
     if (valueId == _config.yearId) {
       auto year = decode(valueId, value);
       if (year) {
         _dateTimeFields.year.value = year.get();
-        _dateTimeFields.year.lastUpdateMs = millis();
+        _dateTimeFields.year.lastUpdateMs = receivedMs;
         _dateTimeFields.availableFields |= 1;
       }
     } else if (valueId == _config.monthId) {
       auto month = decode(valueId, value);
       if (month) {
         _dateTimeFields.month.value = month.get();
-        _dateTimeFields.month.lastUpdateMs = millis();
+        _dateTimeFields.month.lastUpdateMs = receivedMs;
         _dateTimeFields.availableFields |= 2;
       }
     } else if (valueId == _config.dayId) {
       auto day = decode(valueId, value);
       if (day) {
         _dateTimeFields.day.value = day.get();
-        _dateTimeFields.day.lastUpdateMs = millis();
+        _dateTimeFields.day.lastUpdateMs = receivedMs;
         _dateTimeFields.availableFields |= 4;
       }
     } else if (valueId == _config.hourId) {
       auto hour = decode(valueId, value);
       if (hour) {
         _dateTimeFields.hour.value = hour.get();
-        _dateTimeFields.hour.lastUpdateMs = millis();
+        _dateTimeFields.hour.lastUpdateMs = receivedMs;
         _dateTimeFields.availableFields |= 8;
       }
     } else if (valueId == _config.minuteId) {
       auto minute = decode(valueId, value);
       if (minute && (minute.get() != _dateTimeFields.minute.value || _dateTimeFields.minute.lastUpdateMs == 0)) {
         _dateTimeFields.minute.value = minute.get();
-        _dateTimeFields.minute.lastUpdateMs = millis();
+        _dateTimeFields.minute.lastUpdateMs = receivedMs;
         _dateTimeFields.availableFields |= 16;
       }
     }
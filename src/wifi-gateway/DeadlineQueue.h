@@ -0,0 +1,57 @@
+#ifndef DEADLINEQUEUE_H_
+#define DEADLINEQUEUE_H_
+
+#include <vector>
+#include <algorithm>
+
+/**
+ * Min-heap of keys ordered by their due time (millis()), for processing
+ * the earliest deadline first.
+ *
+ * The comparison handles the wrap-around of millis(), as long as all due
+ * times are within ~24 days of each other. Keys are not unique: callers
+ * replace the due time of a key by pushing it again and skip outdated items
+ * when they are popped.
+ */
+template<typename Key>
+class DeadlineQueue final {
+public:
+  struct Item {
+    unsigned long dueMs;
+    Key key;
+  };
+
+private:
+  std::vector<Item> _heap {};
+
+  static bool later(Item const& a, Item const& b) {
+    return static_cast<long>(a.dueMs - b.dueMs) > 0;
+  }
+
+public:
+  void push(unsigned long dueMs, Key const& key) {
+    _heap.push_back({dueMs, key});
+    std::push_heap(_heap.begin(), _heap.end(), later);
+  }
+
+  bool due(unsigned long currentMs) const {
+    return !_heap.empty() && static_cast<long>(currentMs - _heap.front().dueMs) >= 0;
+  }
+
+  Item pop() {
+    std::pop_heap(_heap.begin(), _heap.end(), later);
+    Item item = _heap.back();
+    _heap.pop_back();
+    return item;
+  }
+
+  void clear() {
+    _heap.clear();
+  }
+
+  size_t size() const {
+    return _heap.size();
+  }
+};
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef DEVICEREGISTRY_H_
+#define DEVICEREGISTRY_H_
+
+#include <cstdint>
+#include <algorithm>
+#include "StiebelEltronTypes.h"
+
+/**
+ * Statistics of another participant on the bus, as observed from the frames
+ * it sent or which were addressed to it.
+ */
+struct DeviceStats {
+  DeviceId id;
+  unsigned long lastSeenMs; // last frame sent by the device, 0 if it was only addressed so far
+  uint32_t writes; // frames sent by the device, per message type
+  uint32_t requests;
+  uint32_t responses;
+  uint32_t others;
+  uint32_t requested; // requests addressed to the device
+  uint32_t answered; // responses to those requests
+  uint32_t latencySumMs;
+  uint32_t latencyMaxMs;
+  ValueId pendingValueId; // last request addressed to the device, for measuring its response latency
+  unsigned long pendingMs; // 0 if there is no pending request
+
+  uint32_t averageLatencyMs() const {
+    return answered > 0 ? latencySumMs / answered : 0;
+  }
+};
+
+/**
+ * Registry of other devices on the bus with O(1) lookup by device ID.
+ *
+ * The full ID space (16 types × 128 addresses) is mapped to slots with one
+ * byte per ID, while the statistics are kept in a fixed pool as only a few
+ * devices are present on a real bus. Devices exceeding the pool are counted,
+ * but not tracked.
+ */
+class DeviceRegistry final {
+public:
+  static constexpr size_t TYPE_COUNT = 16;
+  static constexpr size_t ADDRESS_COUNT = 128;
+  static constexpr size_t CAPACITY = 32;
+
+private:
+  static constexpr uint8_t NO_SLOT = 0xFFu;
+
+  uint8_t _slots[TYPE_COUNT * ADDRESS_COUNT];
+  DeviceStats _stats[CAPACITY];
+  uint8_t _size = 0;
+  uint32_t _overflows = 0;
+
+public:
+  DeviceRegistry() {
+    std::fill(_slots, _slots + TYPE_COUNT * ADDRESS_COUNT, NO_SLOT);
+  }
+
+  /**
+   * Statistics of the given device, if it is already known.
+   */
+  DeviceStats* find(DeviceId const& id) {
+    size_t index = indexOf(id);
+    if (index == SIZE_MAX || _slots[index] == NO_SLOT) {
+      return nullptr;
+    }
+    return &_stats[_slots[index]];
+  }
+
+  /**
+   * Statistics of the given device, which is added if not yet known. Only
+   * returns nullptr if the ID is not exact or the registry is full.
+   */
+  DeviceStats* obtain(DeviceId const& id) {
+    size_t index = indexOf(id);
+    if (index == SIZE_MAX) {
+      return nullptr;
+    }
+    if (_slots[index] == NO_SLOT) {
+      if (_size == CAPACITY) {
+        _overflows += 1;
+        return nullptr;
+      }
+      _stats[_size] = DeviceStats{id, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+      _slots[index] = _size;
+      _size += 1;
+    }
+    return &_stats[_slots[index]];
+  }
+
+  const DeviceStats* begin() const { return _stats; }
+  const DeviceStats* end() const { return _stats + _size; }
+
+  size_t size() const { return _size; }
+
+  uint32_t overflows() const { return _overflows; }
+
+private:
+  static size_t indexOf(DeviceId const& id) {
+    if (!id.isExact() || static_cast<uint8_t>(id.type) >= TYPE_COUNT || id.address >= ADDRESS_COUNT) {
+      return SIZE_MAX;
+    }
+    return static_cast<uint8_t>(id.type) * ADDRESS_COUNT + id.address;
+  }
+};
+
+#endif
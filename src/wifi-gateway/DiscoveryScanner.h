@@ -0,0 +1,313 @@
+#ifndef DISCOVERYSCANNER_H_
+#define DISCOVERYSCANNER_H_
+
+#include <iot_core/Interfaces.h>
+#include <iot_core/Utils.h>
+#include <LittleFS.h>
+#include <vector>
+#include "StiebelEltronProtocol.h"
+
+static const char DISCOVERY_FILE_HEADER[] = "~D1.1";
+
+struct DiscoveryResult {
+  ValueId valueId;
+  uint16_t value;
+};
+
+/**
+ * Background job sweeping a range of value IDs on a target device to find out
+ * which IDs it supports.
+ *
+ * Only one request is outstanding at any time and requests are sent no faster
+ * than the configured interval, using the Discovery traffic class (and therefore
+ * its own bus budget). A sweep takes at most one frame per ID (plus retries of
+ * frames which could not be sent), so its duration is predictable. The progress
+ * and the results are persisted regularly, so that a sweep resumes after a reboot.
+ *
+ * Devices respond with VALUE_NOT_AVAILABLE to IDs they do not know, those are
+ * only counted. The IDs found are kept in the order of the sweep (i.e. sorted)
+ * up to MAX_RESULTS; if there are more, the sweep is stopped and marked as
+ * truncated.
+ */
+class DiscoveryScanner final : public iot_core::IApplicationComponent {
+public:
+  static constexpr size_t MAX_RESULTS = 1024;
+  static constexpr uint16_t PERSIST_INTERVAL = 64; // probes
+  static constexpr unsigned long DEFAULT_INTERVAL_MS = 250;
+  static constexpr unsigned long RESPONSE_TIMEOUT_MS = 1000;
+
+private:
+  iot_core::Logger _logger;
+  iot_core::ISystem& _system;
+  StiebelEltronProtocol& _protocol;
+  const IStiebelEltronDevice& _requester;
+  unsigned long _intervalMs = DEFAULT_INTERVAL_MS;
+
+  bool _active = false;
+  DeviceId _targetId {};
+  ValueId _firstId = 0;
+  ValueId _lastId = 0;
+  uint32_t _nextId = 0; // may go past the largest value ID when done
+  uint32_t _probes = 0;
+  uint32_t _timeouts = 0;
+  uint32_t _notSupported = 0;
+  bool _truncated = false;
+  std::vector<DiscoveryResult> _results {};
+
+  uint16_t _scan = 0; // to ignore outcomes of requests from a previous sweep
+  bool _inFlight = false;
+  unsigned long _lastProbeMs = 0;
+  uint16_t _unpersistedProbes = 0;
+
+public:
+  DiscoveryScanner(iot_core::ISystem& system, StiebelEltronProtocol& protocol, const IStiebelEltronDevice& requester)
+    : _logger(system.logger("dsc")),
+    _system(system),
+    _protocol(protocol),
+    _requester(requester) {}
+
+  const char* name() const override {
+    return "dsc";
+  }
+
+  const char* description() const override {
+    return "Discovery Scanner";
+  }
+
+  bool configure(const char* name, const char* value) override {
+    if (strcmp(name, "interval") == 0) return setInterval(toolbox::convert<uint16_t>::fromString(value, nullptr, 10).otherwise(DEFAULT_INTERVAL_MS));
+    return false;
+  }
+
+  void getConfig(std::function<void(const char*, const char*)> writer) const override {
+    writer("interval", toolbox::convert<uint16_t>::toString(_intervalMs, 10).cstr());
+  }
+
+  bool setInterval(uint16_t intervalMs) {
+    _intervalMs = std::max<uint16_t>(intervalMs, 10u);
+    _logger.log(toolbox::format(F("Using interval of %u ms."), _intervalMs));
+    return true;
+  }
+
+  void setup(bool /*connected*/) override {
+    restore();
+    if (_active) {
+      _protocol.setAcceptedSources(name(), {_targetId});
+      _logger.log(iot_core::LogLevel::Info, toolbox::format(F("Resuming discovery of %s at ID %04X."), _targetId.toString(), _nextId));
+    }
+  }
+
+  void loop(iot_core::ConnectionStatus /*status*/) override {
+    if (!_active || _inFlight || !_protocol.ready()) {
+      return;
+    }
+
+    if (millis() - _lastProbeMs < _intervalMs) {
+      return;
+    }
+
+    probe();
+  }
+
+  void getDiagnostics(iot_core::IDiagnosticsCollector& collector) const override {
+    // discovery: <active> <target> <next>/<last> <found> <not supported> (truncated)
+    collector.addValue("discovery", toolbox::format(F("%s %s %04X/%04X %u %u%s"), toolbox::convert<bool>::toString(_active).cstr(), _targetId.toString(), _nextId, _lastId, found(), _notSupported, _truncated ? " truncated" : ""));
+  }
+
+  /**
+   * Start a new sweep of the given range, discarding the results of a previous one.
+   */
+  OperationResult start(DeviceId targetId, ValueId firstId, ValueId lastId) {
+    if (!targetId.isExact() || firstId > lastId) {
+      return OperationResult::Invalid;
+    }
+
+    _scan += 1;
+    _inFlight = false;
+    _active = true;
+    _targetId = targetId;
+    _firstId = firstId;
+    _lastId = lastId;
+    _nextId = firstId;
+    _probes = 0;
+    _timeouts = 0;
+    _notSupported = 0;
+    _truncated = false;
+    _results.clear();
+    _protocol.setAcceptedSources(name(), {_targetId});
+    persist();
+
+    _logger.log(iot_core::LogLevel::Info, toolbox::format(F("Starting discovery of %s for IDs %04X-%04X."), _targetId.toString(), _firstId, _lastId));
+    return OperationResult::Accepted;
+  }
+
+  /**
+   * Stop the current sweep, keeping the results found so far.
+   */
+  void stop() {
+    if (!_active) {
+      return;
+    }
+
+    _scan += 1;
+    _inFlight = false;
+    _active = false;
+    _protocol.setAcceptedSources(name(), {});
+    persist();
+
+    _logger.log(iot_core::LogLevel::Info, toolbox::format(F("Stopped discovery of %s at ID %04X."), _targetId.toString(), _nextId));
+  }
+
+  bool active() const { return _active; }
+  const DeviceId& targetId() const { return _targetId; }
+  ValueId firstId() const { return _firstId; }
+  ValueId lastId() const { return _lastId; }
+  uint32_t nextId() const { return _nextId; }
+  uint32_t probes() const { return _probes; }
+  uint32_t timeouts() const { return _timeouts; }
+  uint32_t notSupported() const { return _notSupported; }
+  bool truncated() const { return _truncated; }
+  const std::vector<DiscoveryResult>& results() const { return _results; }
+  size_t found() const { return _results.size(); }
+
+private:
+  void probe() {
+    ValueId valueId = _nextId;
+    uint16_t scan = _scan;
+    OperationResult result = _protocol.request(
+      { _requester.deviceId(), _targetId, valueId },
+      TrafficClass::Discovery,
+      [this, scan, valueId] (RequestOutcome outcome, ResponseData const* response) { processOutcome(scan, valueId, outcome, response); },
+      RequestPolicy{RESPONSE_TIMEOUT_MS, 0}
+    );
+    _lastProbeMs = millis();
+
+    switch (result) {
+      case OperationResult::Accepted:
+        _inFlight = true;
+        break;
+      case OperationResult::Invalid:
+        _logger.log(iot_core::LogLevel::Error, toolbox::format(F("Discovery request for %s rejected."), _targetId.toString()));
+        stop();
+        break;
+      default:
+        break; // try again after the interval
+    }
+  }
+
+  void processOutcome(uint16_t scan, ValueId valueId, RequestOutcome outcome, ResponseData const* response) {
+    if (scan != _scan) {
+      return;
+    }
+    _inFlight = false;
+
+    switch (outcome) {
+      case RequestOutcome::Responded:
+        if (response->value == VALUE_NOT_AVAILABLE) {
+          _notSupported += 1;
+        } else if (_results.size() < MAX_RESULTS) {
+          _results.push_back({valueId, response->value});
+        } else {
+          _truncated = true;
+          _logger.log(iot_core::LogLevel::Warning, toolbox::format(F("Discovery of %s found more than %u IDs."), _targetId.toString(), MAX_RESULTS));
+          stop(); // nextId stays at the first ID which did not fit
+          return;
+        }
+        break;
+      case RequestOutcome::TimedOut:
+        _timeouts += 1;
+        break;
+      case RequestOutcome::NotSent:
+        return; // probe the same ID again
+    }
+
+    _probes += 1;
+    _nextId += 1;
+    if (_nextId > _lastId) {
+      _active = false;
+      _protocol.setAcceptedSources(name(), {});
+      persist();
+      _logger.log(iot_core::LogLevel::Info, toolbox::format(F("Discovery of %s finished: %u of %u IDs found."), _targetId.toString(), found(), _probes));
+    } else if (++_unpersistedProbes >= PERSIST_INTERVAL) {
+      persist();
+    }
+  }
+
+  static void writeUint16(File& file, uint16_t value) {
+    uint8_t bytes[2] = { (value >> 8) & 0xFFu, value & 0xFFu };
+    file.write(bytes, 2);
+  }
+
+  static void writeUint32(File& file, uint32_t value) {
+    writeUint16(file, value >> 16);
+    writeUint16(file, value & 0xFFFFu);
+  }
+
+  static uint16_t readUint16(File& file) {
+    uint8_t bytes[2] = {0};
+    file.read(bytes, 2);
+    return (bytes[0] << 8) | bytes[1];
+  }
+
+  static uint32_t readUint32(File& file) {
+    uint32_t high = readUint16(file);
+    return (high << 16) | readUint16(file);
+  }
+
+  void restore() {
+    auto discoveryFile = LittleFS.open("/discovery", "r");
+    if (discoveryFile) {
+      if (discoveryFile.available() > 5) {
+        char header[6] = {0};
+        discoveryFile.readBytes(header, 5);
+        if (strcmp(header, DISCOVERY_FILE_HEADER) == 0) {
+          uint8_t state[3] = {0};
+          discoveryFile.read(state, 3);
+          _active = state[0] != 0;
+          _targetId = DeviceId{DeviceType(state[1]), state[2]};
+          _firstId = readUint16(discoveryFile);
+          _lastId = readUint16(discoveryFile);
+          _nextId = readUint32(discoveryFile);
+          _probes = readUint32(discoveryFile);
+          _timeouts = readUint32(discoveryFile);
+          _notSupported = readUint32(discoveryFile);
+          _truncated = discoveryFile.read() == 1;
+          while (discoveryFile.available() >= 4 && _results.size() < MAX_RESULTS) {
+            ValueId valueId = readUint16(discoveryFile);
+            _results.push_back({valueId, readUint16(discoveryFile)});
+            _system.lyield();
+          }
+          _active = _active && _targetId.isExact() && _nextId <= _lastId;
+        } else {
+          // Different file format or version, the discovery has to be started again.
+        }
+      }
+      discoveryFile.close();
+    }
+  }
+
+  void persist() {
+    _unpersistedProbes = 0;
+    auto discoveryFile = LittleFS.open("/discovery", "w");
+    if (discoveryFile) {
+      discoveryFile.write(DISCOVERY_FILE_HEADER);
+      uint8_t state[3] = { _active ? 1u : 0u, static_cast<uint8_t>(_targetId.type), _targetId.address };
+      discoveryFile.write(state, 3);
+      writeUint16(discoveryFile, _firstId);
+      writeUint16(discoveryFile, _lastId);
+      writeUint32(discoveryFile, _nextId);
+      writeUint32(discoveryFile, _probes);
+      writeUint32(discoveryFile, _timeouts);
+      writeUint32(discoveryFile, _notSupported);
+      discoveryFile.write(static_cast<uint8_t>(_truncated ? 1u : 0u));
+      for (auto& result : _results) {
+        writeUint16(discoveryFile, result.valueId);
+        writeUint16(discoveryFile, result.value);
+        _system.lyield();
+      }
+      discoveryFile.close();
+    }
+  }
+};
+
+#endif
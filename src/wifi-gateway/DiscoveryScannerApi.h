@@ -0,0 +1,132 @@
+#ifndef DISCOVERYSCANNERAPI_H_
+#define DISCOVERYSCANNERAPI_H_
+
+#include <iot_core/api/Interfaces.h>
+#include <jsons.h>
+#include "DiscoveryScanner.h"
+
+class DiscoveryScannerApi final : public iot_core::api::IProvider {
+private:
+  iot_core::Logger _logger;
+  iot_core::ISystem& _system;
+  DiscoveryScanner& _scanner;
+
+public:
+  DiscoveryScannerApi(iot_core::ISystem& system, DiscoveryScanner& scanner)
+  : _logger(system.logger("api")), _system(system), _scanner(scanner) {}
+
+  void setupApi(iot_core::api::IServer& server) override {
+    server.on(F("/api/discovery"), iot_core::api::HttpMethod::GET, [this](iot_core::api::IRequest& request, iot_core::api::IResponse& response) {
+      getDiscovery(request, response);
+    });
+
+    server.on(F("/api/discovery"), iot_core::api::HttpMethod::POST, [this](iot_core::api::IRequest& request, iot_core::api::IResponse& response) {
+      postDiscovery(request, response);
+    });
+
+    server.on(F("/api/discovery"), iot_core::api::HttpMethod::DELETE, [this](iot_core::api::IRequest& request, iot_core::api::IResponse& response) {
+      _scanner.stop();
+      response.code(iot_core::api::ResponseCode::OkNoContent);
+    });
+  }
+
+private:
+  void getDiscovery(iot_core::api::IRequest&, iot_core::api::IResponse& response) {
+    auto& body = response
+      .code(iot_core::api::ResponseCode::Ok)
+      .contentType(iot_core::api::ContentType::ApplicationJson)
+      .sendChunkedBody();
+
+    if (!body.valid()) {
+      return;
+    }
+
+    auto writer = jsons::makeWriter(body);
+
+    writer.openObject();
+    writer.property(F("active")).boolean(_scanner.active());
+    writer.property(F("target")).string(_scanner.targetId().toString());
+    writer.property(F("firstId")).number(_scanner.firstId());
+    writer.property(F("lastId")).number(_scanner.lastId());
+    writer.property(F("nextId")).number(_scanner.nextId());
+    writer.property(F("probes")).number(_scanner.probes());
+    writer.property(F("timeouts")).number(_scanner.timeouts());
+    writer.property(F("found")).number(_scanner.found());
+    writer.property(F("notSupported")).number(_scanner.notSupported());
+    writer.property(F("truncated")).boolean(_scanner.truncated());
+    writer.property(F("results"));
+    writer.openList();
+    for (auto& result : _scanner.results()) {
+      writer.openObject();
+      writer.property(F("valueId")).number(result.valueId);
+      writer.property(F("value")).number(result.value);
+      writer.close();
+      _system.lyield();
+    }
+    writer.close();
+    writer.close();
+
+    writer.end();
+  }
+
+  /**
+   * Start a new discovery sweep.
+   *
+   * For example:
+   * { "target": "HEA/1", "firstId": 0, "lastId": 4095 }
+   */
+  void postDiscovery(iot_core::api::IRequest& request, iot_core::api::IResponse& response) {
+    toolbox::Maybe<DeviceId> targetId {};
+    int32_t firstId = 0;
+    int32_t lastId = 0xFFFF;
+    bool valid = true;
+
+    auto reader = jsons::makeReader(request.body());
+    auto json = reader.begin();
+    auto object = json.asObject();
+    if (object.valid()) {
+      for (auto& property : object) {
+        if (property.name() == "target" && property.type() == jsons::ValueType::String) {
+          targetId = DeviceId::fromString(property.asString().get());
+        } else if (property.name() == "firstId" && property.type() == jsons::ValueType::Integer) {
+          firstId = property.asInteger().get();
+        } else if (property.name() == "lastId" && property.type() == jsons::ValueType::Integer) {
+          lastId = property.asInteger().get();
+        } else {
+          valid = false;
+        }
+      }
+    } else {
+      valid = false;
+    }
+    reader.end();
+
+    if (reader.failed()) {
+      response
+        .code(iot_core::api::ResponseCode::BadRequest)
+        .contentType(iot_core::api::ContentType::TextPlain)
+        .sendSingleBody().write(toolbox::format(F("JSON error: %s"), reader.diagnostics().errorMessage.cstr()));
+      return;
+    }
+
+    if (!valid || !targetId || firstId < 0 || lastId > 0xFFFF) {
+      response
+        .code(iot_core::api::ResponseCode::BadRequest)
+        .contentType(iot_core::api::ContentType::TextPlain)
+        .sendSingleBody().write(F("Failed to parse discovery request."));
+      return;
+    }
+
+    if (_scanner.start(targetId.get(), firstId, lastId) != OperationResult::Accepted) {
+      response
+        .code(iot_core::api::ResponseCode::BadRequest)
+        .contentType(iot_core::api::ContentType::TextPlain)
+        .sendSingleBody().write(F("Target must be an exact device ID and firstId must not be larger than lastId."));
+      return;
+    }
+
+    response.code(iot_core::api::ResponseCode::OkAccepted);
+  }
+};
+
+#endif
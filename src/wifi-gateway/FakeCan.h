@@ -55,6 +55,7 @@ public:
         message.ext = false;
         message.rtr = false;
         message.len = 7;
+        message.timestampMs = millis();
         message.data[0] = 0xD0u;
         message.data[1] = 0x3Cu;
         message.data[2] = 0xFAu;
@@ -110,12 +111,16 @@ public:
     _messageHandler = messageHandler;
   }
 
-  OperationResult sendCanMessage(const CanMessage& message) override {
+  OperationResult sendCanMessage(const CanMessage& message, TrafficClass trafficClass, TxCompletionHandler completionHandler = nullptr) override {
+    if (completionHandler) completionHandler(true);
     return OperationResult::Accepted; // FakeCan always accepts messages
   }
 
-  float getAvailableTokens() const override {
-    return 999.0f; // FakeCan has unlimited budget
+  uint32_t getAvailableTokens(TrafficClass trafficClass) const override {
+    return 999u; // FakeCan has unlimited budget
+  }
+
+  void setAcceptedIds(std::vector<uint32_t> const& /*ids*/) override {
   }
 
   CanCounters const& counters() const override {
@@ -0,0 +1,66 @@
+#ifndef LATENCYHISTOGRAM_H_
+#define LATENCYHISTOGRAM_H_
+
+#include <cstdint>
+#include <algorithm>
+
+/**
+ * Histogram of latencies with fixed, roughly logarithmic buckets. Percentiles
+ * are reported as the upper limit of the bucket they fall into, which is good
+ * enough for diagnostics and needs neither sorting nor storing samples.
+ */
+class LatencyHistogram final {
+public:
+  static constexpr size_t BUCKET_COUNT = 12;
+  static constexpr uint32_t BUCKET_LIMITS_MS[BUCKET_COUNT] = { 2, 5, 10, 20, 50, 100, 200, 500, 1000, 2000, 5000, UINT32_MAX };
+
+private:
+  uint32_t _buckets[BUCKET_COUNT] = {};
+  uint32_t _count = 0;
+  uint32_t _maxMs = 0;
+
+public:
+  void add(uint32_t latencyMs) {
+    size_t bucket = 0;
+    while (latencyMs > BUCKET_LIMITS_MS[bucket]) {
+      ++bucket;
+    }
+    _buckets[bucket] += 1;
+    _count += 1;
+    _maxMs = std::max(_maxMs, latencyMs);
+  }
+
+  void reset() {
+    std::fill(_buckets, _buckets + BUCKET_COUNT, 0u);
+    _count = 0;
+    _maxMs = 0;
+  }
+
+  uint32_t count() const {
+    return _count;
+  }
+
+  uint32_t maxMs() const {
+    return _maxMs;
+  }
+
+  /**
+   * Upper bound of the given percentile (0-100), limited by the maximum seen.
+   */
+  uint32_t percentileMs(uint8_t percentile) const {
+    if (_count == 0) {
+      return 0;
+    }
+    uint32_t rank = (static_cast<uint64_t>(_count) * percentile + 99u) / 100u;
+    uint32_t cumulative = 0;
+    for (size_t bucket = 0; bucket < BUCKET_COUNT; ++bucket) {
+      cumulative += _buckets[bucket];
+      if (cumulative >= rank) {
+        return std::min(BUCKET_LIMITS_MS[bucket], _maxMs);
+      }
+    }
+    return _maxMs;
+  }
+};
+
+#endif
@@ -138,7 +138,7 @@ private:
     
     _buffer.clear();
     auto writer = jsons::makeWriter(_buffer);
-    serializer::serialize(writer, _conversion, _definitions, entry, true, true);
+    serializer::serialize(writer, _conversion, _definitions, _access, entry, true, true);
     if (writer.failed()) {
       _logger.log(iot_core::LogLevel::Error, F("Serializing data entry failed."));
     } else if (_buffer.overrun()) {
@@ -5,29 +5,414 @@
 #include <serial_transport.h>
 #include <gpiobj.h>
 #include "CanInterface.h"
+#include "TxRateLimiter.h"
+#include "LatencyHistogram.h"
+#include "CanTrace.h"
+
+/*
+ * Binary CAN frame record exchanged with the serial-can-bridge, if both sides
+ * have negotiated it (bridge advertises "READY BIN", gateway requests it with
+ * "SETUP <bitrate> <mode> BIN[ D<batch delay ms>]"). Otherwise the text format is used.
+ *
+ * The ID uses the same flag bits as the text format (bit 31 = extended, bit 30 = RTR)
+ * and is transferred in little endian byte order (native on both the AVR and ESP8266).
+ * Received frames carry the micros() timestamp of the bridge when they were taken
+ * from the MCP2515, which gets mapped onto the local clock (see BridgeClock).
+ * Frames to be sent carry a sequence tag (1-255) in the timestamp field instead,
+ * which the bridge echoes in its reply ("CANTX OK|ESEND|ENOAV|ENVAL <tag hex>").
+ *
+ * If a batch delay is requested, the bridge packs received frames into batches:
+ * [CAN_FRAME_BATCH_RX][count][CanFrameData x count].
+ *
+ * If the bridge advertises "READY ... FLT", the gateway can restrict the frames the
+ * MCP2515 accepts by appending " F<mask 0>,<mask 1>,<filter 0>,...,<filter 5>" (hex)
+ * to the SETUP message. The bridge then reports the hits per filter periodically
+ * with "FILTER <hits 0> ... <hits 5>".
+ *
+ * The bridge buffers received frames in a RAM ring buffer and reports its state
+ * periodically with "STATS <size> <high water> <overflows> <driver peak> <driver size>"
+ * (a driver peak above the driver size means the driver buffer overflowed as well).
+ *
+ * NOTE: this must be kept in sync with serial-can-bridge.ino!
+ */
+const uint8_t CAN_FRAME_RECORD_RX = 0x01u;
+const uint8_t CAN_FRAME_RECORD_TX = 0x02u;
+const uint8_t CAN_FRAME_BATCH_RX = 0x03u;
+
+const uint32_t CAN_FRAME_ID_MASK = 0x1FFFFFFFu;
+const uint32_t CAN_FRAME_EXT_FLAG = 0x80000000u;
+const uint32_t CAN_FRAME_RTR_FLAG = 0x40000000u;
+
+struct __attribute__((__packed__)) CanFrameData {
+  uint32_t id;
+  uint8_t len;
+  uint8_t data[8];
+  uint32_t timestampUs;
+};
+
+struct __attribute__((__packed__)) CanFrameRecord {
+  uint8_t type;
+  CanFrameData frame;
+};
+
+static_assert(sizeof(CanFrameRecord) == 18, "CanFrameRecord must be packed");
+
+const uint8_t CAN_FRAME_BATCH_HEADER_SIZE = 2u;
+
+/**
+ * Acceptance masks and filters of the MCP2515 for standard IDs. Mask 0 applies
+ * to filters 0-1, mask 1 to filters 2-5.
+ */
+struct AcceptanceFilter {
+  static constexpr size_t FILTER_COUNT = 6;
+  static constexpr uint16_t STANDARD_ID_MASK = 0x7FFu;
+
+  uint16_t masks[2];
+  uint16_t filters[FILTER_COUNT];
+
+  /**
+   * Build masks and filters which accept at least the given IDs. If there are
+   * more distinct IDs than filters, bits are dropped from the mask one by one,
+   * always the one merging the most IDs, until the remaining filter values fit.
+   */
+  static AcceptanceFilter forIds(std::vector<uint32_t> const& ids) {
+    uint16_t mask = STANDARD_ID_MASK;
+    while (countFilterValues(ids, mask) > FILTER_COUNT) {
+      uint16_t bestMask = 0u;
+      size_t bestCount = SIZE_MAX;
+      for (uint8_t bit = 0; bit < 11; ++bit) {
+        uint16_t candidate = mask & ~(1u << bit);
+        if (candidate == mask) {
+          continue;
+        }
+        size_t count = countFilterValues(ids, candidate);
+        if (count < bestCount) {
+          bestCount = count;
+          bestMask = candidate;
+        }
+      }
+      mask = bestMask;
+    }
+
+    AcceptanceFilter filter {{mask, mask}, {}};
+    size_t count = 0;
+    for (auto id : ids) {
+      uint16_t value = id & mask;
+      if (std::find(filter.filters, filter.filters + count, value) == filter.filters + count) {
+        filter.filters[count++] = value;
+      }
+    }
+    for (size_t i = count; i < FILTER_COUNT; ++i) {
+      filter.filters[i] = filter.filters[0]; // unused filters just repeat the first one
+    }
+    return filter;
+  }
+
+private:
+  static size_t countFilterValues(std::vector<uint32_t> const& ids, uint16_t mask) {
+    uint16_t values[FILTER_COUNT + 1];
+    size_t count = 0;
+    for (auto id : ids) {
+      uint16_t value = id & mask;
+      if (std::find(values, values + count, value) == values + count) {
+        values[count++] = value;
+        if (count > FILTER_COUNT) {
+          break;
+        }
+      }
+    }
+    return count;
+  }
+};
+
+/**
+ * Maps timestamps of the bridge's clock onto the local clock.
+ *
+ * The difference between the local receive time and the bridge timestamp is the
+ * clock offset plus the (variable) transfer delay. The smallest difference seen
+ * is therefore the best estimate of the offset. To follow clock drift, only the
+ * minimum of the current and the previous window is used.
+ */
+class BridgeClock final {
+public:
+  static constexpr unsigned long WINDOW_MS = 10000;
+
+private:
+  bool _valid = false;
+  uint32_t _previousMinOffsetUs = 0;
+  uint32_t _currentMinOffsetUs = 0;
+  unsigned long _windowStartMs = 0;
+
+  static bool before(uint32_t a, uint32_t b) {
+    return static_cast<int32_t>(a - b) < 0;
+  }
+
+public:
+  void reset() {
+    _valid = false;
+  }
+
+  /**
+   * Returns the estimated local micros() at which the bridge took the timestamp.
+   */
+  uint32_t toLocalUs(uint32_t bridgeUs, uint32_t localUs, unsigned long currentMs) {
+    uint32_t offsetUs = localUs - bridgeUs;
+    if (!_valid) {
+      _previousMinOffsetUs = offsetUs;
+      _currentMinOffsetUs = offsetUs;
+      _windowStartMs = currentMs;
+      _valid = true;
+    } else if (currentMs - _windowStartMs >= WINDOW_MS) {
+      _previousMinOffsetUs = _currentMinOffsetUs;
+      _currentMinOffsetUs = offsetUs;
+      _windowStartMs = currentMs;
+    } else if (before(offsetUs, _currentMinOffsetUs)) {
+      _currentMinOffsetUs = offsetUs;
+    }
+    uint32_t bestOffsetUs = before(_currentMinOffsetUs, _previousMinOffsetUs) ? _currentMinOffsetUs : _previousMinOffsetUs;
+    return bridgeUs + bestOffsetUs;
+  }
+};
+
+/**
+ * State of the receive buffers of the bridge as last reported.
+ */
+struct BridgeRxStats {
+  uint32_t ringSize = 0;
+  uint32_t ringHighWater = 0;
+  uint32_t ringOverflows = 0;
+  uint32_t driverPeak = 0;
+  uint32_t driverSize = 0;
+};
+
+struct TxQueueEntry {
+  CanMessage message;
+  unsigned long queuedMs;
+  TxCompletionHandler completionHandler;
+};
+
+/**
+ * Bounded FIFO queue for CAN messages of one traffic class, including
+ * statistics about its depth and the time messages spent waiting.
+ */
+class TxQueue final {
+public:
+  static constexpr size_t CAPACITY = 8;
+
+private:
+  TxQueueEntry _entries[CAPACITY];
+  size_t _head = 0;
+  size_t _size = 0;
+
+public:
+  uint32_t maxDepth = 0;
+  uint32_t sent = 0;
+  uint32_t rejected = 0;
+  uint32_t totalWaitMs = 0;
+  uint32_t maxWaitMs = 0;
+
+  bool empty() const { return _size == 0; }
+  bool full() const { return _size == CAPACITY; }
+  size_t size() const { return _size; }
+
+  bool push(const CanMessage& message, unsigned long currentMs, TxCompletionHandler completionHandler) {
+    if (full()) {
+      rejected += 1;
+      return false;
+    }
+    _entries[(_head + _size) % CAPACITY] = {message, currentMs, completionHandler};
+    _size += 1;
+    maxDepth = std::max<uint32_t>(maxDepth, _size);
+    return true;
+  }
+
+  TxQueueEntry& front() {
+    return _entries[_head];
+  }
+
+  void pop(unsigned long currentMs) {
+    uint32_t waitMs = currentMs - _entries[_head].queuedMs;
+    totalWaitMs += waitMs;
+    maxWaitMs = std::max(maxWaitMs, waitMs);
+    sent += 1;
+    _entries[_head].completionHandler = nullptr;
+    _head = (_head + 1) % CAPACITY;
+    _size -= 1;
+  }
+
+  void clear() {
+    while (!empty()) {
+      TxCompletionHandler completionHandler = std::move(front().completionHandler);
+      front().completionHandler = nullptr;
+      _head = (_head + 1) % CAPACITY;
+      _size -= 1;
+      if (completionHandler) completionHandler(false);
+    }
+    _head = 0;
+  }
+
+  uint32_t averageWaitMs() const {
+    return sent > 0 ? totalWaitMs / sent : 0;
+  }
+};
+
+struct TxInFlightEntry {
+  uint8_t tag;
+  unsigned long queuedMs;
+  unsigned long sentMs;
+  TxCompletionHandler completionHandler;
+};
+
+/**
+ * Frames which have been passed to the bridge and wait for its reply. As the
+ * bridge handles frames in order, the replies arrive in order as well.
+ */
+class TxInFlight final {
+public:
+  static constexpr size_t CAPACITY = 8;
+
+private:
+  TxInFlightEntry _entries[CAPACITY];
+  size_t _head = 0;
+  size_t _size = 0;
+
+public:
+  bool empty() const { return _size == 0; }
+  bool full() const { return _size == CAPACITY; }
+  size_t size() const { return _size; }
+
+  void push(uint8_t tag, unsigned long queuedMs, unsigned long sentMs, TxCompletionHandler completionHandler) {
+    _entries[(_head + _size) % CAPACITY] = {tag, queuedMs, sentMs, completionHandler};
+    _size += 1;
+  }
+
+  const TxInFlightEntry& front() const {
+    return _entries[_head];
+  }
+
+  /**
+   * Number of entries in front of the one with the given tag, or -1 if there is none.
+   */
+  int find(uint8_t tag) const {
+    for (size_t i = 0; i < _size; ++i) {
+      if (_entries[(_head + i) % CAPACITY].tag == tag) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  TxInFlightEntry pop() {
+    TxInFlightEntry entry = std::move(_entries[_head]);
+    _entries[_head].completionHandler = nullptr;
+    _head = (_head + 1) % CAPACITY;
+    _size -= 1;
+    return entry;
+  }
+};
+
+/**
+ * Phases of resetting the bridge: the reset pin is held for a while, then the
+ * serial connection is reset and the bridge gets some time to start before it
+ * is released. The reset is complete once the bridge reports a successful setup.
+ */
+enum struct ResetPhase : uint8_t {
+  Hold = 0,
+  Release = 1,
+  Connect = 2,
+  Done = 3,
+};
+
+static constexpr size_t RESET_PHASE_COUNT = 3; // phases which take time
+
+toolbox::strref resetPhaseToString(ResetPhase phase) {
+  switch (phase) {
+    case ResetPhase::Hold: return "Hold";
+    case ResetPhase::Release: return "Release";
+    case ResetPhase::Connect: return "Connect";
+    case ResetPhase::Done: return "Done";
+    default: return "?";
+  }
+}
 
 class SerialCan final : public ICanInterface, public iot_core::IApplicationComponent {
 private:
   static const uint32_t CAN_BITRATE = 20UL * 1000UL; // 20 kbit/s
   static constexpr uint32_t MAX_ERR_COUNT = 5;
+  static constexpr unsigned long TX_REPLY_TIMEOUT_MS = 1000;
+  static constexpr unsigned long RESET_HOLD_MS = 200;
+  static constexpr unsigned long RESET_RELEASE_MS = 100;
 
-  // Token bucket rate limiter for 20 kbit/s bus protection
+  // Token bucket rate limiter (per traffic class) for 20 kbit/s bus protection
   // Analysis: ~4.4ms per CAN frame (worst case with bit stuffing)
-  // Theoretical max: ~220 frames/sec, we use ~12 frames/sec = ~5.4% bus utilization
-  static constexpr float MAX_FRAMES_PER_SECOND = 12.0f;
-  static constexpr float MAX_BURST_TOKENS = 6.0f;
+  // Theoretical max: ~220 frames/sec. The refill rate adapts to the bus load caused
+  // by the other participants between the configured min and max TX rate:
+  // the max rate is used up to BUS_LOAD_QUIET_PERMILLE, the min rate from
+  // BUS_LOAD_BUSY_PERMILLE and it is interpolated linearly in between.
+  // With an acceptance filter, only the accepted frames are seen and the bus
+  // load would be underestimated, so the min rate is used instead.
+  static constexpr uint8_t DEFAULT_MIN_TX_RATE = 6u; // frames/s
+  static constexpr uint8_t DEFAULT_MAX_TX_RATE = 24u; // frames/s
+  static constexpr uint16_t DEFAULT_TRACE_SIZE = 128u; // frames (16 bytes each)
+  static constexpr int32_t BUS_LOAD_QUIET_PERMILLE = 100;
+  static constexpr int32_t BUS_LOAD_BUSY_PERMILLE = 400;
+  static constexpr unsigned long BUS_LOAD_WINDOW_MS = 1000;
+  static constexpr int32_t BUS_LOAD_SMOOTHING_DIVISOR = 4; // weight of the latest window = 1/4
+
+  static constexpr const char* TX_QUEUE_DIAGNOSTICS_NAMES[TRAFFIC_CLASS_COUNT] = { "txqWrite", "txqTimeSync", "txqRegistration", "txqPoll", "txqDiscovery" };
+  static constexpr const char* BUDGET_DIAGNOSTICS_NAMES[TRAFFIC_CLASS_COUNT] = { "budgetWrite", "budgetTimeSync", "budgetRegistration", "budgetPoll", "budgetDiscovery" };
+  static constexpr const char* SHARE_CONFIG_NAMES[TRAFFIC_CLASS_COUNT] = { "writeShare", "timeSyncShare", "registrationShare", "pollShare", "discoveryShare" };
+  static constexpr const char* BURST_CONFIG_NAMES[TRAFFIC_CLASS_COUNT] = { "writeBurst", "timeSyncBurst", "registrationBurst", "pollBurst", "discoveryBurst" };
 
   iot_core::Logger _logger;
   iot_core::ISystem& _system;
   gpiobj::DigitalOutput& _resetPin;
   gpiobj::DigitalInput& _txEnablePin;
   bool _canAvailable;
+  bool _binaryFramesEnabled;
+  bool _binaryFrames;
+  uint16_t _rxBatchDelayMs;
+  uint32_t _rxBatches;
+  uint16_t _traceSize = DEFAULT_TRACE_SIZE;
+  CanTrace _trace {};
   iot_core::IntervalTimer _resetInterval;
+  ResetPhase _resetPhase = ResetPhase::Done;
+  unsigned long _resetPhaseStartMs = 0;
+  uint32_t _resetPhaseDurationsMs[RESET_PHASE_COUNT] = {}; // of the last reset
+  uint32_t _resets = 0;
   std::function<void()> _readyHandler;
   std::function<void(const CanMessage& message)> _messageHandler;
   
-  unsigned long _lastTokenRefillMs;
-  float _availableTokens;
+  TxRateLimiter _rateLimiter;
+
+  uint8_t _minTxRate = DEFAULT_MIN_TX_RATE;
+  uint8_t _maxTxRate = DEFAULT_MAX_TX_RATE;
+  uint8_t _txRate = DEFAULT_MIN_TX_RATE;
+  int32_t _busLoadPermille = 0;
+  uint32_t _busLoadWindowBits = 0;
+  unsigned long _busLoadWindowStartMs = 0;
+
+  BridgeClock _bridgeClock;
+  uint32_t _rxLatencySumUs = 0;
+  uint32_t _rxLatencyMaxUs = 0;
+  uint32_t _rxLatencyCount = 0;
+
+  TxQueue _txQueues[TRAFFIC_CLASS_COUNT];
+  TxInFlight _txInFlight;
+  uint8_t _txSequence = 0;
+  uint32_t _txFailed = 0;
+  LatencyHistogram _txLatency; // from queueing to the reply of the bridge
+
+  bool _hwFilterEnabled = false;
+  bool _bridgeFilters = false; // bridge supports acceptance filters
+  bool _filterActive = false; // acceptance filter has been requested with the last SETUP
+  std::vector<uint32_t> _acceptedIds {};
+  AcceptanceFilter _acceptanceFilter {};
+  uint32_t _filterHits = 0;
+  uint32_t _filterMisses = 0; // frames passing the (coarser) hardware filter without being needed
+  uint32_t _bridgeFilterHits[AcceptanceFilter::FILTER_COUNT] = {};
+
+  BridgeRxStats _bridgeRxStats {};
   
   CanMode _mode = CanMode::ListenOnly;
   CanCounters _counters;
@@ -41,14 +426,17 @@ public:
     _resetPin(resetPin),
     _txEnablePin(txEnablePin),
     _canAvailable(false),
+    _binaryFramesEnabled(true),
+    _binaryFrames(false),
+    _rxBatchDelayMs(10),
+    _rxBatches(0),
     _resetInterval(5000),
     _counters(),
-    _lastTokenRefillMs(0),
-    _availableTokens(MAX_BURST_TOKENS),
+    _rateLimiter(),
     _serial(
       serial_transport::EndpointRole::CLIENT,
       Serial,
-      [this] (const uint8_t* payload, uint8_t payloadLen, serial_transport::Endpoint& serial) { processReceived(reinterpret_cast<const char*>(payload), serial); },
+      [this] (const uint8_t* payload, uint8_t payloadLen, serial_transport::Endpoint& serial) { processReceived(payload, payloadLen, serial); },
       [this] (serial_transport::ConnectionState state, serial_transport::Endpoint& serial) { handleConnectionState(state, serial); },
       [this] (char direction, uint8_t type, uint8_t sequenceNumber, const uint8_t* payload, uint8_t payloadLen) { handleFrame(direction, type, sequenceNumber, payload, payloadLen); }
     )
@@ -61,11 +449,34 @@ public:
 
   bool configure(const char* name, const char* value) override {
     if (strcmp(name, "mode") == 0) return setMode(canModeFromString(value));
+    if (strcmp(name, "binaryFrames") == 0) return setBinaryFramesEnabled(toolbox::convert<bool>::fromString(value).otherwise(true));
+    if (strcmp(name, "hwFilter") == 0) return setHwFilterEnabled(toolbox::convert<bool>::fromString(value).otherwise(false));
+    if (strcmp(name, "rxBatchDelay") == 0) return setRxBatchDelay(toolbox::convert<uint16_t>::fromString(value, nullptr, 10).otherwise(10));
+    if (strcmp(name, "minTxRate") == 0) return setMinTxRate(toolbox::convert<uint8_t>::fromString(value, nullptr, 10).otherwise(DEFAULT_MIN_TX_RATE));
+    if (strcmp(name, "maxTxRate") == 0) return setMaxTxRate(toolbox::convert<uint8_t>::fromString(value, nullptr, 10).otherwise(DEFAULT_MAX_TX_RATE));
+    if (strcmp(name, "trace") == 0) return setTraceSize(toolbox::convert<uint16_t>::fromString(value, nullptr, 10).otherwise(DEFAULT_TRACE_SIZE));
+    if (strcmp(name, "sharedBurst") == 0) return setSharedBurst(toolbox::convert<uint8_t>::fromString(value, nullptr, 10).otherwise(6));
+    for (size_t i = 0; i < TRAFFIC_CLASS_COUNT; ++i) {
+      if (strcmp(name, SHARE_CONFIG_NAMES[i]) == 0) return setShare(TrafficClass(i), toolbox::convert<uint8_t>::fromString(value, nullptr, 10).otherwise(0));
+      if (strcmp(name, BURST_CONFIG_NAMES[i]) == 0) return setBurst(TrafficClass(i), toolbox::convert<uint8_t>::fromString(value, nullptr, 10).otherwise(1));
+    }
     return false;
   }
 
   void getConfig(std::function<void(const char*, const char*)> writer) const override {
     writer("mode", canModeToString(_mode).cstr());
+    writer("binaryFrames", toolbox::convert<bool>::toString(_binaryFramesEnabled).cstr());
+    writer("hwFilter", toolbox::convert<bool>::toString(_hwFilterEnabled).cstr());
+    writer("rxBatchDelay", toolbox::convert<uint16_t>::toString(_rxBatchDelayMs, 10).cstr());
+    writer("minTxRate", toolbox::convert<uint8_t>::toString(_minTxRate, 10).cstr());
+    writer("maxTxRate", toolbox::convert<uint8_t>::toString(_maxTxRate, 10).cstr());
+    writer("trace", toolbox::convert<uint16_t>::toString(_traceSize, 10).cstr());
+    writer("sharedBurst", toolbox::convert<uint8_t>::toString(_rateLimiter.sharedBurst(), 10).cstr());
+    for (size_t i = 0; i < TRAFFIC_CLASS_COUNT; ++i) {
+      auto& budget = _rateLimiter.budget(TrafficClass(i));
+      writer(SHARE_CONFIG_NAMES[i], toolbox::convert<uint8_t>::toString(budget.sharePercent, 10).cstr());
+      writer(BURST_CONFIG_NAMES[i], toolbox::convert<uint8_t>::toString(budget.burst, 10).cstr());
+    }
   }
 
   bool setMode(CanMode mode) override {
@@ -75,6 +486,94 @@ public:
     return true;
   }
 
+  bool setBinaryFramesEnabled(bool enabled) {
+    if (enabled != _binaryFramesEnabled) {
+      _binaryFramesEnabled = enabled;
+      reset();
+    }
+    _logger.log(toolbox::format(F("Binary frames %s."), _binaryFramesEnabled ? "enabled" : "disabled"));
+    return true;
+  }
+
+  bool setTraceSize(uint16_t size) {
+    _traceSize = std::min<uint16_t>(size, CanTrace::MAX_CAPACITY);
+    if (!_trace.resize(_traceSize)) {
+      _logger.log(iot_core::LogLevel::Warning, toolbox::format(F("Failed to allocate trace of %u frames."), _traceSize));
+      return true;
+    }
+    _logger.log(toolbox::format(F("Using trace of %u frames."), _traceSize));
+    return true;
+  }
+
+  const CanTrace& trace() const {
+    return _trace;
+  }
+
+  bool setRxBatchDelay(uint16_t delayMs) {
+    if (delayMs != _rxBatchDelayMs) {
+      _rxBatchDelayMs = delayMs;
+      reset();
+    }
+    _logger.log(toolbox::format(F("Using RX batch delay of %u ms."), _rxBatchDelayMs));
+    return true;
+  }
+
+  bool setHwFilterEnabled(bool enabled) {
+    if (enabled != _hwFilterEnabled) {
+      _hwFilterEnabled = enabled;
+      reset();
+    }
+    _logger.log(toolbox::format(F("Hardware acceptance filter %s."), _hwFilterEnabled ? "enabled" : "disabled"));
+    return true;
+  }
+
+  /**
+   * The limits are restored one at a time, so they are not checked against
+   * each other here: a min above the max is clamped to the max when used.
+   */
+  bool setMinTxRate(uint8_t minTxRate) {
+    if (minTxRate == 0) {
+      _logger.log(iot_core::LogLevel::Warning, F("Invalid min TX rate of 0 frames/s."));
+      return false;
+    }
+    _minTxRate = minTxRate;
+    updateTxRate();
+    _logger.log(toolbox::format(F("Using min TX rate of %u frames/s."), _minTxRate));
+    return true;
+  }
+
+  bool setMaxTxRate(uint8_t maxTxRate) {
+    if (maxTxRate == 0) {
+      _logger.log(iot_core::LogLevel::Warning, F("Invalid max TX rate of 0 frames/s."));
+      return false;
+    }
+    _maxTxRate = maxTxRate;
+    updateTxRate();
+    _logger.log(toolbox::format(F("Using max TX rate of %u frames/s."), _maxTxRate));
+    return true;
+  }
+
+  bool setShare(TrafficClass trafficClass, uint8_t sharePercent) {
+    if (!_rateLimiter.setShare(trafficClass, sharePercent)) {
+      _logger.log(iot_core::LogLevel::Warning, toolbox::format(F("Invalid share of %u%% for %s."), sharePercent, trafficClassToString(trafficClass).cstr()));
+      return false;
+    }
+    _logger.log(toolbox::format(F("Using share of %u%% for %s (%u%% assigned in total)."), sharePercent, trafficClassToString(trafficClass).cstr(), _rateLimiter.assignedSharePercent()));
+    return true;
+  }
+
+  bool setBurst(TrafficClass trafficClass, uint8_t burst) {
+    _rateLimiter.setBurst(trafficClass, burst);
+    _logger.log(toolbox::format(F("Using burst of %u frames for %s."), burst, trafficClassToString(trafficClass).cstr()));
+    return true;
+  }
+
+  bool setSharedBurst(uint8_t burst) {
+    _rateLimiter.setSharedBurst(burst);
+    _logger.log(toolbox::format(F("Using shared burst of %u frames."), burst));
+    return true;
+  }
+
   CanMode effectiveMode() const {
     return _txEnablePin ? _mode : CanMode::ListenOnly;
   }
@@ -82,14 +581,23 @@ public:
   void setup(bool /*connected*/) override {
     _logger.log(iot_core::LogLevel::Info, F("Initializing SerialCan."));
     _serial.setup();
+    _trace.resize(_traceSize);
     delay(100);
     reset();
   }
 
   void loop(iot_core::ConnectionStatus /*status*/) override {
+    if (resetting()) {
+      advanceReset();
+      return;
+    }
+
     _serial.loop();
 
-    refillTokenBucket(); // Periodically refill to maintain budget
+    updateBusLoad();
+    checkTxTimeouts();
+    _rateLimiter.refill(millis(), _txRate); // Periodically refill to maintain budget
+    drainTxQueues();
 
     if (!ready() && _resetInterval.elapsed()) {
       _logger.log(iot_core::LogLevel::Error, F("Timeout: resetting CAN module."));
@@ -104,9 +612,41 @@ public:
   
   void getDiagnostics(iot_core::IDiagnosticsCollector& collector) const override {
     collector.addValue("available", toolbox::convert<bool>::toString(_canAvailable));
+    // resets: <count> <current phase> <hold>/<release>/<connect> ms (of the last reset)
+    collector.addValue("resets", toolbox::format(F("%u %s %u/%u/%u ms"), _resets, resetPhaseToString(_resetPhase).cstr(), _resetPhaseDurationsMs[0], _resetPhaseDurationsMs[1], _resetPhaseDurationsMs[2]));
+    collector.addValue("binaryFrames", toolbox::convert<bool>::toString(_binaryFrames));
     collector.addValue("err", toolbox::convert<uint32_t>::toString(_counters.err, 10));
     collector.addValue("rx", toolbox::convert<uint32_t>::toString(_counters.rx, 10));
+    // trace: <recorded>/<capacity> <total>
+    collector.addValue("trace", toolbox::format(F("%u/%u %u"), _trace.size(), _trace.capacity(), _trace.total()));
+    collector.addValue("rxBatches", toolbox::convert<uint32_t>::toString(_rxBatches, 10));
+    collector.addValue("rxLatency", toolbox::format(F("%u/%u us"), _rxLatencyCount > 0 ? _rxLatencySumUs / _rxLatencyCount : 0, _rxLatencyMaxUs));
+    if (_filterActive) {
+      // filter: <IDs> <mask> <hits>/<misses>, bridge: hits per filter
+      collector.addValue("filter", toolbox::format(F("%u %03X %u/%u"), _acceptedIds.size(), _acceptanceFilter.masks[0], _filterHits, _filterMisses));
+      collector.addValue("filterBridge", toolbox::format(F("%u %u %u %u %u %u"), _bridgeFilterHits[0], _bridgeFilterHits[1], _bridgeFilterHits[2], _bridgeFilterHits[3], _bridgeFilterHits[4], _bridgeFilterHits[5]));
+    } else {
+      collector.addValue("filter", "off");
+    }
+    // bridge RX: <ring high water>/<ring size> <ring overflows> (<driver peak>/<driver size>)
+    collector.addValue("bridgeRx", toolbox::format(F("%u/%u %u (%u/%u)"), _bridgeRxStats.ringHighWater, _bridgeRxStats.ringSize, _bridgeRxStats.ringOverflows, _bridgeRxStats.driverPeak, _bridgeRxStats.driverSize));
     collector.addValue("tx", toolbox::convert<uint32_t>::toString(_counters.tx, 10));
+    collector.addValue("txFailed", toolbox::convert<uint32_t>::toString(_txFailed, 10));
+    collector.addValue("txInFlight", toolbox::convert<uint32_t>::toString(_txInFlight.size(), 10));
+    // latency from queueing to the reply of the bridge: <p50>/<p90>/<p99>/<max> ms
+    collector.addValue("txLatency", toolbox::format(F("%u/%u/%u/%u ms"), _txLatency.percentileMs(50), _txLatency.percentileMs(90), _txLatency.percentileMs(99), _txLatency.maxMs()));
+    // bus load as seen by the gateway, i.e. only the accepted frames while filtering
+    collector.addValue("busLoad", toolbox::format(F("%u.%u%%%s"), _busLoadPermille / 10, _busLoadPermille % 10, _filterActive ? " (filtered)" : ""));
+    collector.addValue("txRate", toolbox::format(F("%u/s"), _txRate));
+    for (size_t i = 0; i < TRAFFIC_CLASS_COUNT; ++i) {
+      // queue: <depth>/<max depth> <avg wait>/<max wait> ms
+      const TxQueue& queue = _txQueues[i];
+      collector.addValue(TX_QUEUE_DIAGNOSTICS_NAMES[i], toolbox::format(F("%u/%u %u/%u ms"), queue.size(), queue.maxDepth, queue.averageWaitMs(), queue.maxWaitMs));
+      // budget: <tokens>/<burst> <granted> (<borrowed from shared pool>)
+      auto& budget = _rateLimiter.budget(TrafficClass(i));
+      collector.addValue(BUDGET_DIAGNOSTICS_NAMES[i], toolbox::format(F("%u.%03u/%u %u (%u)"), budget.milliTokens / 1000u, budget.milliTokens % 1000u, budget.burst, budget.granted, budget.borrowed));
+    }
+    collector.addValue("budgetShared", toolbox::format(F("%u.%03u/%u"), _rateLimiter.sharedMilliTokens() / 1000u, _rateLimiter.sharedMilliTokens() % 1000u, _rateLimiter.sharedBurst()));
   }
 
   void reset() override {
@@ -129,7 +669,7 @@ public:
     _messageHandler = messageHandler;
   }
 
-  OperationResult sendCanMessage(const CanMessage& message) override {
+  OperationResult sendCanMessage(const CanMessage& message, TrafficClass trafficClass, TxCompletionHandler completionHandler = nullptr) override {
     if (effectiveMode() == CanMode::ListenOnly) {
       return OperationResult::NotReady;
     }
@@ -138,23 +678,38 @@ public:
       return OperationResult::NotReady;
     }
 
-    if (_availableTokens < 1.0f) {
-      return OperationResult::RateLimited;
-    }
-
-    if (!queueCanTxMessage(_serial, message.id, message.ext, message.rtr, message.len, message.data)) {
+    if (!_txQueues[static_cast<size_t>(trafficClass)].push(message, millis(), completionHandler)) {
       return OperationResult::QueueFull;
     }
 
-    logCanMessage("TX", message);
-
-    _availableTokens -= 1.0f;
-    _counters.tx += 1;
+    // Send right away if the budget allows it
+    _rateLimiter.refill(millis(), _txRate);
+    drainTxQueues();
     return OperationResult::Accepted;
   }
 
-  float getAvailableTokens() const override {
-    return _availableTokens;
+  uint32_t getAvailableTokens(TrafficClass trafficClass) const override {
+    return _rateLimiter.availableFrames(trafficClass);
+  }
+
+  void setAcceptedIds(std::vector<uint32_t> const& ids) override {
+    std::vector<uint32_t> acceptedIds {};
+    for (auto id : ids) {
+      acceptedIds.push_back(id & AcceptanceFilter::STANDARD_ID_MASK);
+    }
+    std::sort(acceptedIds.begin(), acceptedIds.end());
+    acceptedIds.erase(std::unique(acceptedIds.begin(), acceptedIds.end()), acceptedIds.end());
+    if (acceptedIds == _acceptedIds) {
+      return;
+    }
+
+    _acceptedIds = std::move(acceptedIds);
+    _acceptanceFilter = AcceptanceFilter::forIds(_acceptedIds);
+    _logger.log(iot_core::LogLevel::Info, toolbox::format(F("Accepting %u IDs (mask %03X)."), _acceptedIds.size(), _acceptanceFilter.masks[0]));
+
+    if (_canAvailable && (_filterActive || useAcceptanceFilter())) {
+      queueSetup(); // the bridge has to set up the MCP2515 again to apply the filters
+    }
   }
 
   CanCounters const& counters() const override {
@@ -162,26 +717,225 @@ public:
   }
 
 private: 
-  void refillTokenBucket() {
+  /**
+   * Find the queue of the traffic class with the highest priority, which has
+   * messages waiting and budget available.
+   */
+  int nextTxQueue() const {
+    for (size_t i = 0; i < TRAFFIC_CLASS_COUNT; ++i) {
+      if (!_txQueues[i].empty() && _rateLimiter.available(TrafficClass(i))) {
+        return i;
+      }
+    }
+    return -1;
+  }
+
+  void drainTxQueues() {
+    while (_canAvailable && !_txInFlight.full()) {
+      int next = nextTxQueue();
+      if (next < 0) {
+        return;
+      }
+
+      TxQueue& queue = _txQueues[next];
+      TxQueueEntry& entry = queue.front();
+      uint8_t tag = nextTxSequence();
+      if (!queueCanTx(entry.message, tag)) {
+        return; // serial transport is busy, try again later
+      }
+
+      unsigned long currentMs = millis();
+      _trace.record(TraceDirection::Tx, entry.message, currentMs);
+      _txInFlight.push(tag, entry.queuedMs, currentMs, std::move(entry.completionHandler));
+      queue.pop(currentMs);
+      _rateLimiter.consume(TrafficClass(next));
+    }
+  }
+
+  uint8_t nextTxSequence() {
+    _txSequence = _txSequence == 255 ? 1 : _txSequence + 1; // 0 is reserved for untagged frames
+    return _txSequence;
+  }
+
+  /**
+   * Complete the in-flight frame with the given tag (or the oldest one for untagged
+   * replies). Frames sent before it must have lost their reply, so they failed.
+   */
+  void completeTx(int tag, bool sent) {
+    int index = tag < 0 ? 0 : _txInFlight.find(tag);
+    if (index < 0 || _txInFlight.empty()) {
+      _logger.log(iot_core::LogLevel::Warning, toolbox::format(F("CANTX reply for unknown frame %d."), tag));
+      return;
+    }
+    for (; index > 0; --index) {
+      finishTx(_txInFlight.pop(), false);
+    }
+    finishTx(_txInFlight.pop(), sent);
+  }
+
+  void finishTx(TxInFlightEntry entry, bool sent) {
+    _txLatency.add(millis() - entry.queuedMs);
+    if (sent) {
+      _counters.tx += 1;
+    } else {
+      _txFailed += 1;
+    }
+    if (entry.completionHandler) entry.completionHandler(sent);
+  }
+
+  void checkTxTimeouts() {
+    unsigned long currentMs = millis();
+    while (!_txInFlight.empty() && currentMs - _txInFlight.front().sentMs >= TX_REPLY_TIMEOUT_MS) {
+      _counters.err += 1;
+      _logger.log(iot_core::LogLevel::Error, toolbox::format(F("CANTX timeout for frame %u."), _txInFlight.front().tag));
+      finishTx(_txInFlight.pop(), false);
+    }
+  }
+
+  void clearTxQueues() {
+    for (auto& queue : _txQueues) {
+      queue.clear();
+    }
+    while (!_txInFlight.empty()) {
+      finishTx(_txInFlight.pop(), false);
+    }
+  }
+
+  bool queueCanTx(const CanMessage& message, uint8_t tag) {
+    if (!_binaryFrames) {
+      return queueCanTxMessage(_serial, message.id, message.ext, message.rtr, message.len, message.data);
+    }
+
+    if (!_serial.canQueue()) {
+      return false;
+    }
+
+    CanFrameRecord record;
+    record.type = CAN_FRAME_RECORD_TX;
+    record.frame.id = (message.id & CAN_FRAME_ID_MASK) | (message.ext ? CAN_FRAME_EXT_FLAG : 0u) | (message.rtr ? CAN_FRAME_RTR_FLAG : 0u);
+    record.frame.len = message.len;
+    memcpy(record.frame.data, message.data, 8);
+    record.frame.timestampUs = tag;
+    return _serial.queue(reinterpret_cast<const uint8_t*>(&record), sizeof(record));
+  }
+
+  /**
+   * Number of bits a standard or extended CAN frame occupies on the bus,
+   * including worst case bit stuffing and the interframe space.
+   */
+  static uint32_t frameBits(const CanMessage& message) {
+    uint32_t stuffableBits = (message.ext ? 54u : 34u) + 8u * message.len;
+    uint32_t fixedBits = 13u; // CRC delimiter, ACK, EOF and IFS are never stuffed
+    return stuffableBits + (stuffableBits - 1u) / 4u + fixedBits;
+  }
+
+  void trackBusLoad(const CanMessage& message) {
+    _busLoadWindowBits += frameBits(message);
+  }
+
+  void updateBusLoad() {
     unsigned long currentMs = millis();
-    if (_lastTokenRefillMs > 0) {
-      float elapsedSeconds = (currentMs - _lastTokenRefillMs) / 1000.0f;
-      _availableTokens = std::min(_availableTokens + (MAX_FRAMES_PER_SECOND * elapsedSeconds), MAX_BURST_TOKENS);
+    unsigned long elapsedMs = currentMs - _busLoadWindowStartMs;
+    if (elapsedMs < BUS_LOAD_WINDOW_MS) {
+      return;
+    }
+
+    // bits * 1000 / (bits per ms * ms) = permille
+    int32_t windowLoadPermille = std::min<uint32_t>((_busLoadWindowBits * 1000u) / ((CAN_BITRATE / 1000u) * elapsedMs), 1000u);
+    _busLoadPermille += (windowLoadPermille - _busLoadPermille) / BUS_LOAD_SMOOTHING_DIVISOR;
+    _busLoadWindowBits = 0;
+    _busLoadWindowStartMs = currentMs;
+
+    updateTxRate();
+  }
+
+  void updateTxRate() {
+    uint8_t minTxRate = std::min(_minTxRate, _maxTxRate);
+    if (_filterActive) {
+      _txRate = minTxRate;
+      return;
+    }
+    int32_t busyness = std::max<int32_t>(0, std::min(_busLoadPermille, BUS_LOAD_BUSY_PERMILLE) - BUS_LOAD_QUIET_PERMILLE);
+    _txRate = _maxTxRate - ((_maxTxRate - minTxRate) * busyness) / (BUS_LOAD_BUSY_PERMILLE - BUS_LOAD_QUIET_PERMILLE);
+  }
+
+  bool useAcceptanceFilter() const {
+    return _hwFilterEnabled && _bridgeFilters && !_acceptedIds.empty();
+  }
+
+  void queueSetup() {
+    static char setup[80]; // "SETUP XXXXXXXX XXX BIN DXXXXX FXXX,XXX,XXX,XXX,XXX,XXX,XXX,XXX"
+    int length = snprintf(setup, sizeof(setup), "SETUP %X %s", CAN_BITRATE, toSetupModeString(effectiveMode()));
+    if (_binaryFrames) {
+      length += snprintf(setup + length, sizeof(setup) - length, " BIN");
+      if (_rxBatchDelayMs > 0) {
+        length += snprintf(setup + length, sizeof(setup) - length, " D%u", _rxBatchDelayMs);
+      }
+    }
+    _filterActive = useAcceptanceFilter();
+    updateTxRate();
+    if (_filterActive) {
+      const AcceptanceFilter& filter = _acceptanceFilter;
+      snprintf(setup + length, sizeof(setup) - length, " F%X,%X,%X,%X,%X,%X,%X,%X",
+        filter.masks[0], filter.masks[1], filter.filters[0], filter.filters[1], filter.filters[2], filter.filters[3], filter.filters[4], filter.filters[5]);
+    }
+    _filterHits = 0;
+    _filterMisses = 0;
+    memset(_bridgeFilterHits, 0, sizeof(_bridgeFilterHits));
+    _serial.queue(setup);
+  }
+
+  void trackFilter(const CanMessage& message) {
+    if (!_filterActive || message.ext) {
+      return;
+    }
+    if (std::binary_search(_acceptedIds.begin(), _acceptedIds.end(), message.id)) {
+      _filterHits += 1;
+    } else {
+      _filterMisses += 1;
     }
-    _lastTokenRefillMs = currentMs;
   }
 
   void resetInternal() {
     _canAvailable = false;
     _counters = CanCounters{};
+    _rxBatches = 0;
+    resetRxLatency();
+    clearTxQueues();
 
+    _resets += 1;
+    std::fill(_resetPhaseDurationsMs, _resetPhaseDurationsMs + RESET_PHASE_COUNT, 0u);
+    _resetPhase = ResetPhase::Hold;
+    _resetPhaseStartMs = millis();
     _resetPin = true;
-    delay(200);
-    _serial.reset();
-    delay(100);
-    _resetPin = false;
-    
-    _resetInterval.restart();
+  }
+
+  /**
+   * Whether the bridge is held in reset, i.e. the serial connection must not be used.
+   */
+  bool resetting() const {
+    return _resetPhase == ResetPhase::Hold || _resetPhase == ResetPhase::Release;
+  }
+
+  void advanceReset() {
+    unsigned long elapsedMs = millis() - _resetPhaseStartMs;
+    if (_resetPhase == ResetPhase::Hold && elapsedMs >= RESET_HOLD_MS) {
+      _serial.reset();
+      nextResetPhase(ResetPhase::Release);
+    } else if (_resetPhase == ResetPhase::Release && elapsedMs >= RESET_RELEASE_MS) {
+      _resetPin = false;
+      _resetInterval.restart();
+      nextResetPhase(ResetPhase::Connect);
+    }
+  }
+
+  void nextResetPhase(ResetPhase phase) {
+    unsigned long currentMs = millis();
+    if (_resetPhase != ResetPhase::Done) {
+      _resetPhaseDurationsMs[static_cast<size_t>(_resetPhase)] = currentMs - _resetPhaseStartMs;
+    }
+    _resetPhase = phase;
+    _resetPhaseStartMs = currentMs;
   }
 
   void handleConnectionState(serial_transport::ConnectionState state, serial_transport::Endpoint& /*serial*/) {
@@ -190,30 +944,38 @@ private:
     }
     if (state != serial_transport::ConnectionState::CONNECTED) {
       _canAvailable = false;
+      _binaryFrames = false;
+      _bridgeFilters = false;
+      _filterActive = false;
+      updateTxRate();
+      _bridgeRxStats = BridgeRxStats{};
+      _bridgeClock.reset();
     }
 
     iot_core::LogLevel level = state == serial_transport::ConnectionState::CLOSED ? iot_core::LogLevel::Warning : iot_core::LogLevel::Info;
     _logger.log(level, toolbox::format(F("Serial connection: %s"), serial_transport::describe(state).ref()));
   }
 
-  void handleFrame(char direction, uint8_t type, uint8_t sequenceNumber, const uint8_t* payload, uint8_t payloadLen) {
-    bool isDataOrAck = (type == serial_transport::Endpoint::FRAME_TYPE_DATA) || (type == serial_transport::Endpoint::FRAME_TYPE_ACK);
-    bool isCanTx = isDataOrAck && (payloadLen >= 6) && (strncmp(reinterpret_cast<const char*>(payload), "CANTX", 5) == 0);
-    if (isDataOrAck && !isCanTx) {
+  void handleFrame(char direction, uint8_t type, uint8_t sequenceNumber, const uint8_t* /*payload*/, uint8_t payloadLen) {
+    // CAN frames are recorded in the trace, only log the control frames of the link
+    if ((type == serial_transport::Endpoint::FRAME_TYPE_DATA) || (type == serial_transport::Endpoint::FRAME_TYPE_ACK)) {
       return;
     }
-    _logger.log(iot_core::LogLevel::Debug, [&] () {
-      static char logMessage[96]; // "TX|RX FRAME type=XX seq=XX len=X ...";
-      int insertPos = snprintf(logMessage, 96, "%cX FRAME T=%02X S=%02X L=%u ", direction, type, sequenceNumber, payloadLen);
-      for (size_t i = 0; i < payloadLen; ++i) {
-        logMessage[insertPos++] = payload[i];
-      }
-      logMessage[insertPos] = '\0';
-      return logMessage;
-    });
+    _logger.log(iot_core::LogLevel::Debug, [&] () { return toolbox::format(F("%cX FRAME T=%02X S=%02X L=%u"), direction, type, sequenceNumber, payloadLen); });
   }
 
-  void processReceived(const char* message, serial_transport::Endpoint& serial) {
+  void processReceived(const uint8_t* payload, uint8_t payloadLen, serial_transport::Endpoint& serial) {
+    if (payloadLen == sizeof(CanFrameRecord) && payload[0] == CAN_FRAME_RECORD_RX) {
+      processReceivedFrame(payload + 1);
+      return;
+    }
+
+    if (payloadLen >= CAN_FRAME_BATCH_HEADER_SIZE && payload[0] == CAN_FRAME_BATCH_RX) {
+      processReceivedBatch(payload, payloadLen);
+      return;
+    }
+
+    const char* message = reinterpret_cast<const char*>(payload);
     const char* start = message;
     char* end = nullptr;
 
@@ -239,6 +1001,7 @@ private:
       message.ext = (id & 0x80000000u) != 0;
       message.rtr = (id & 0x40000000u) != 0;
       message.len = len;
+      message.timestampMs = millis();
 
       for (size_t i = 0; i < message.len; ++i) {
         message.data[i] = strtol(start, &end, 16);
@@ -250,37 +1013,77 @@ private:
         start = end;
       }
 
-      logCanMessage("RX", message);
+      _trace.record(TraceDirection::Rx, message, message.timestampMs);
 
       if (_messageHandler) _messageHandler(message);
 
       _counters.rx += 1;
+      trackBusLoad(message);
+      trackFilter(message);
     } else if (strncmp(start, "CANTX ", 6) == 0) {
-      if (strncmp(start + 6, "OK", 2) == 0) {
-        // Success - no action needed
-      } else if (strncmp(start + 6, "ENVAL", 5) == 0) {
-        _counters.err += 1;
+      const char* result = start + 6;
+      const char* tagStart = strchr(result, ' ');
+      int tag = tagStart != nullptr ? strtol(tagStart + 1, &end, 16) : -1;
+      if (strncmp(result, "OK", 2) == 0) {
+        completeTx(tag, true);
+        return;
+      }
+
+      _counters.err += 1;
+      if (strncmp(result, "ENVAL", 5) == 0) {
         _logger.log(iot_core::LogLevel::Error, F("CANTX ENVAL: Invalid CAN message format or parameters"));
-      } else if (strncmp(start + 6, "ESEND", 5) == 0) {
-        _counters.err += 1;
+      } else if (strncmp(result, "ESEND", 5) == 0) {
         _logger.log(iot_core::LogLevel::Error, F("CANTX ESEND: CAN TX buffer full, message dropped"));
-      } else if (strncmp(start + 6, "ENOAV", 5) == 0) {
-        _counters.err += 1;
+      } else if (strncmp(result, "ENOAV", 5) == 0) {
         _logger.log(iot_core::LogLevel::Error, F("CANTX ENOAV: CAN module not available"));
       } else {
-        _counters.err += 1;
         _logger.log(iot_core::LogLevel::Error, [&] () { return toolbox::format(F("CANTX unknown error: %s"), message); });
       }
+      completeTx(tag, false);
     } else if (strncmp(start, "READY", 5) == 0) {
-      serial.queue(toolbox::format(F("SETUP %X %s"), CAN_BITRATE, toSetupModeString(effectiveMode())));
+      _binaryFrames = _binaryFramesEnabled && strstr(start + 5, " BIN") != nullptr;
+      _bridgeFilters = strstr(start + 5, " FLT") != nullptr;
+      queueSetup();
     } else if (strncmp(start, "SETUP ", 6) == 0) {
+      bool wasAvailable = _canAvailable;
       _canAvailable = strncmp(start + 6, "OK ", 3) == 0;
       if (_canAvailable) {
         _logger.log(iot_core::LogLevel::Info, message);
-        if (_readyHandler) _readyHandler();
+        if (_resetPhase == ResetPhase::Connect) {
+          nextResetPhase(ResetPhase::Done);
+          _logger.log(iot_core::LogLevel::Info, toolbox::format(F("CAN module reset took %u/%u/%u ms."), _resetPhaseDurationsMs[0], _resetPhaseDurationsMs[1], _resetPhaseDurationsMs[2]));
+        }
+        if (!wasAvailable && _readyHandler) _readyHandler(); // not again if only the filters changed
       } else {
         _logger.log(iot_core::LogLevel::Error, message);
       }
+    } else if (strncmp(start, "FILTER ", 7) == 0) {
+      start += 7;
+      for (size_t i = 0; i < AcceptanceFilter::FILTER_COUNT; ++i) {
+        _bridgeFilterHits[i] = strtoul(start, &end, 10);
+        if (end == start) {
+          _counters.err += 1;
+          _logger.log(iot_core::LogLevel::Error, toolbox::format(F("FILTER: Invalid hits at index %u '%s'"), i, message));
+          return;
+        }
+        start = end;
+      }
+    } else if (strncmp(start, "STATS ", 6) == 0) {
+      start += 6;
+      uint32_t values[5];
+      for (size_t i = 0; i < 5; ++i) {
+        values[i] = strtoul(start, &end, 10);
+        if (end == start) {
+          _counters.err += 1;
+          _logger.log(iot_core::LogLevel::Error, toolbox::format(F("STATS: Invalid value at index %u '%s'"), i, message));
+          return;
+        }
+        start = end;
+      }
+      if (values[2] > _bridgeRxStats.ringOverflows || (values[3] > values[4] && _bridgeRxStats.driverPeak <= _bridgeRxStats.driverSize)) {
+        _logger.log(iot_core::LogLevel::Warning, toolbox::format(F("CAN bridge dropped received frames: %s"), message));
+      }
+      _bridgeRxStats = BridgeRxStats{values[0], values[1], values[2], values[3], values[4]};
     } else if (strncmp(start, "RESET ", 6) == 0) {
       _logger.log(iot_core::LogLevel::Info, toolbox::format(F("CAN bridge reset reason: %s"), start + 6));
     } else {
@@ -289,23 +1092,67 @@ private:
     }
   }
 
-  void logCanMessage(const char* prefix, const CanMessage& message) {
-    _logger.log(iot_core::LogLevel::Debug, [&] () {
-      static char logMessage[36]; // "XX 123456789 xr 8 FFFFFFFFFFFFFFFF";
-      int insertPos = 0;
-      insertPos += snprintf(logMessage + insertPos, 36 - insertPos, "%s %x ", prefix, message.id);
-      if (message.ext) {
-        logMessage[insertPos++] = 'x';
-      }
-      if (message.rtr) {
-        logMessage[insertPos++] = 'r';
-      }
-      insertPos += snprintf(logMessage + insertPos, 36 - insertPos, " %u ", message.len);
-      for (size_t i = 0; i < message.len; ++i) {
-        insertPos += snprintf(logMessage + insertPos, 36 - insertPos, "%02X", message.data[i]);
-      }
-      return logMessage;
-    });
+  void processReceivedBatch(const uint8_t* payload, uint8_t payloadLen) {
+    uint8_t count = payload[1];
+    if (payloadLen != CAN_FRAME_BATCH_HEADER_SIZE + count * sizeof(CanFrameData)) {
+      _counters.err += 1;
+      _logger.log(iot_core::LogLevel::Error, toolbox::format(F("CANRX: Invalid batch of %u frames with length %u"), count, payloadLen));
+      return;
+    }
+
+    _rxBatches += 1;
+
+    for (uint8_t i = 0; i < count; ++i) {
+      processReceivedFrame(payload + CAN_FRAME_BATCH_HEADER_SIZE + i * sizeof(CanFrameData));
+    }
+  }
+
+  void processReceivedFrame(const uint8_t* frameData) {
+    CanFrameData frame;
+    memcpy(&frame, frameData, sizeof(frame));
+
+    if (frame.len > 8) {
+      _counters.err += 1;
+      _logger.log(iot_core::LogLevel::Error, toolbox::format(F("CANRX: Invalid length %u"), frame.len));
+      return;
+    }
+
+    CanMessage message;
+    message.id = frame.id & CAN_FRAME_ID_MASK;
+    message.ext = (frame.id & CAN_FRAME_EXT_FLAG) != 0;
+    message.rtr = (frame.id & CAN_FRAME_RTR_FLAG) != 0;
+    message.len = frame.len;
+    memcpy(message.data, frame.data, 8);
+    message.timestampMs = toLocalMs(frame.timestampUs);
+
+    _trace.record(TraceDirection::Rx, message, message.timestampMs);
+
+    if (_messageHandler) _messageHandler(message);
+
+    _counters.rx += 1;
+    trackBusLoad(message);
+    trackFilter(message);
+  }
+
+  unsigned long toLocalMs(uint32_t bridgeUs) {
+    uint32_t localUs = micros();
+    unsigned long currentMs = millis();
+    uint32_t latencyUs = localUs - _bridgeClock.toLocalUs(bridgeUs, localUs, currentMs);
+    
+    if (_rxLatencySumUs > UINT32_MAX - latencyUs) {
+      resetRxLatency();
+    }
+    _rxLatencySumUs += latencyUs;
+    _rxLatencyMaxUs = std::max(_rxLatencyMaxUs, latencyUs);
+    _rxLatencyCount += 1;
+
+    return currentMs - latencyUs / 1000u;
+  }
+
+  void resetRxLatency() {
+    _rxLatencySumUs = 0;
+    _rxLatencyMaxUs = 0;
+    _rxLatencyCount = 0;
   }
 
   const char* toSetupModeString(CanMode mode) const {
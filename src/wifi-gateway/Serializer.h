@@ -7,7 +7,7 @@
 
 namespace serializer {
 
-void serialize(jsons::IWriter& writer, const IConversionService& conversion, const IDefinitionRepository& definitions, const DataEntry& entry, bool compact = false, bool numbersAsDecimals = false) {
+void serialize(jsons::IWriter& writer, const IConversionService& conversion, const IDefinitionRepository& definitions, const DataAccess& access, const DataEntry& entry, bool compact = false, bool numbersAsDecimals = false) {
   auto& definition = definitions.get(entry.id);
 
   writer.openObject();
@@ -38,6 +38,11 @@ void serialize(jsons::IWriter& writer, const IConversionService& conversion, con
   if (!compact) {
     writer.property(F("subscribed")).boolean(entry.subscribed);
     writer.property(F("writable")).boolean(entry.writable);
+    const PollState* state = access.getPollState({entry.source, entry.id});
+    writer.property(F("suspectedDead")).boolean(state != nullptr && state->isSuspectedDead());
+    if (entry.subscribed) {
+      writer.property(F("pollInterval")).number(access.pollIntervalMs(entry) / 1000u);
+    }
   }
   
   writer.close();
@@ -4,8 +4,11 @@
 #include <iot_core/Interfaces.h>
 #include "StiebelEltronTypes.h"
 #include "CanInterface.h"
+#include "LatencyHistogram.h"
+#include "DeviceRegistry.h"
 #include <functional>
-#include <set>
+#include <algorithm>
+#include <vector>
 
 /*
  * NOTE: the protocol is actually based on the Elster-Kromschröder protocol,
@@ -134,6 +137,153 @@ public:
   virtual void receive(const ResponseData& data) = 0;
 };
 
+/**
+ * A decoded write, request or response as seen on the bus.
+ */
+struct ProtocolMessage {
+  MessageType type;
+  DeviceId sourceId;
+  DeviceId targetId;
+  ValueId valueId;
+  uint16_t value; // 0 for requests
+  unsigned long timestampMs; // millis() at which the message was received from the bus
+};
+
+/**
+ * Describes which messages a listener is interested in. By default nothing
+ * matches; at least one message type has to be given.
+ */
+struct MessageInterest {
+  uint8_t messageTypes = 0; // bit mask of the message types
+  DeviceId sourceId {}; // any source by default
+  ValueId minValueId = 0;
+  ValueId maxValueId = 0xFFFFu;
+  std::vector<ValueId> valueIds {}; // if not empty, only these IDs (instead of the range)
+
+  static uint8_t typeBit(MessageType type) {
+    return 1u << static_cast<uint8_t>(type);
+  }
+
+  MessageInterest& type(MessageType type) {
+    messageTypes |= typeBit(type);
+    return *this;
+  }
+
+  MessageInterest& from(DeviceId source) {
+    sourceId = source;
+    return *this;
+  }
+
+  MessageInterest& range(ValueId min, ValueId max) {
+    minValueId = min;
+    maxValueId = max;
+    return *this;
+  }
+
+  MessageInterest& ids(std::vector<ValueId> ids) {
+    valueIds = std::move(ids);
+    return *this;
+  }
+
+  bool matches(DeviceId const& source, ValueId valueId) const {
+    return sourceId.includes(source) && (!valueIds.empty() || (valueId >= minValueId && valueId <= maxValueId));
+  }
+};
+
+using MessageHandler = std::function<void(ProtocolMessage const& message)>;
+
+struct MessageListener {
+  const char* name; // also used as diagnostics key, so it has to be a literal
+  MessageInterest interest;
+  MessageHandler handler;
+  uint32_t invocations;
+  uint32_t timeUs;
+};
+
+using ListenerId = size_t;
+
+enum struct RequestOutcome : uint8_t {
+  Responded = 0, // the target responded to the request
+  TimedOut = 1, // the target did not respond in time (including retries)
+  NotSent = 2, // the request could not be sent
+};
+
+const char* requestOutcomeToString(RequestOutcome outcome) {
+  switch (outcome) {
+    case RequestOutcome::Responded: return "Responded";
+    case RequestOutcome::TimedOut: return "TimedOut";
+    case RequestOutcome::NotSent: return "NotSent";
+    default: return "?";
+  }
+}
+
+/**
+ * Called once a request has been completed. The response is only given for
+ * RequestOutcome::Responded and is nullptr otherwise.
+ */
+using RequestCompletionHandler = std::function<void(RequestOutcome outcome, ResponseData const* response)>;
+
+struct RequestPolicy {
+  unsigned long timeoutMs = 2000; // from the transmission of the request
+  uint8_t retries = 1;
+};
+
+/**
+ * Request/response statistics per target device.
+ */
+struct TargetStats {
+  static constexpr size_t RECENT_UNANSWERED_SIZE = 4;
+
+  DeviceId target {};
+  uint32_t requests = 0;
+  uint32_t responses = 0;
+  uint32_t retries = 0;
+  uint32_t timeouts = 0;
+  uint32_t notSent = 0;
+  uint32_t rttSumMs = 0;
+  uint32_t rttMaxMs = 0;
+  ValueId recentUnanswered[RECENT_UNANSWERED_SIZE] {}; // IDs which timed out without a response since, most recent first
+  uint8_t recentUnansweredCount = 0;
+
+  uint32_t averageRttMs() const {
+    return responses > 0 ? rttSumMs / responses : 0;
+  }
+
+  void addUnanswered(ValueId valueId) {
+    removeUnanswered(valueId);
+    size_t count = std::min<size_t>(recentUnansweredCount + 1u, RECENT_UNANSWERED_SIZE);
+    std::copy_backward(recentUnanswered, recentUnanswered + count - 1, recentUnanswered + count);
+    recentUnanswered[0] = valueId;
+    recentUnansweredCount = count;
+  }
+
+  void removeUnanswered(ValueId valueId) {
+    ValueId* end = std::remove(recentUnanswered, recentUnanswered + recentUnansweredCount, valueId);
+    recentUnansweredCount = end - recentUnanswered;
+  }
+};
+
+enum struct PendingState : uint8_t {
+  Free = 0,
+  Queued = 1, // waiting for the CAN interface to send it
+  Sent = 2, // waiting for the response
+  Retry = 3, // waiting to be queued again
+};
+
+struct PendingRequest {
+  PendingState state = PendingState::Free;
+  TrafficClass trafficClass = TrafficClass::Poll;
+  uint8_t retriesLeft = 0;
+  uint16_t ticket = 0; // distinguishes requests reusing the same slot
+  DeviceId sourceId {};
+  DeviceId targetId {};
+  ValueId valueId = 0;
+  unsigned long timeoutMs = 0;
+  unsigned long sentMs = 0;
+  unsigned long retryMs = 0; // when it had to be queued again, it is given up timeoutMs later
+  std::vector<RequestCompletionHandler> completionHandlers {}; // of the request and those coalesced with it
+};
+
 class StiebelEltronProtocol final : public iot_core::IApplicationComponent {
 private:
   iot_core::Logger _logger;
@@ -143,11 +293,35 @@ private:
 
   iot_core::ConstStrMap<IStiebelEltronDevice*> _devices {};
 
-  std::set<DeviceId> _otherDeviceIds {};
-
-  std::function<void(ResponseData const& data)> _responseListener {};
-  std::function<void(WriteData const& data)> _writeListener {};
-  std::function<void(RequestData const& data)> _requestListener {};
+  DeviceRegistry _otherDevices {};
+
+  iot_core::ConstStrMap<std::vector<DeviceId>> _acceptedSources {};
+
+  static constexpr size_t PENDING_CAPACITY = 16;
+  PendingRequest _pending[PENDING_CAPACITY] {};
+  uint16_t _nextTicket = 0;
+  uint32_t _coalescedRequests = 0; // requests which did not need a frame of their own
+
+  // Requests only go to the few devices the gateway reads from, so the stats are
+  // kept in a fixed pool. Further targets share the last entry (with a wildcard ID).
+  static constexpr size_t TARGET_CAPACITY = 8;
+  TargetStats _targetStats[TARGET_CAPACITY] {};
+  uint8_t _targetCount = 0;
+  LatencyHistogram _rtt {};
+
+  /**
+   * Listeners to be called per message type: those interested in specific value
+   * IDs are indexed by the ID (sorted by ID, then listener), all others are
+   * checked one by one.
+   */
+  struct ListenerIndex {
+    std::vector<std::pair<ValueId, ListenerId>> byValueId {};
+    std::vector<ListenerId> others {};
+  };
+
+  static constexpr size_t DISPATCHED_MESSAGE_TYPES = 3; // Write, Request, Response
+  std::vector<MessageListener> _listeners {};
+  ListenerIndex _listenerIndex[DISPATCHED_MESSAGE_TYPES] {};
   
 public:
   StiebelEltronProtocol(iot_core::ISystem& system, ICanInterface& can)
@@ -181,9 +355,34 @@ public:
   }
 
   void loop(iot_core::ConnectionStatus /*status*/) override {
+    maintainPendingRequests();
   }
 
-  void getDiagnostics(iot_core::IDiagnosticsCollector& /*collector*/) const override {
+  void getDiagnostics(iot_core::IDiagnosticsCollector& collector) const override {
+    TargetStats total {};
+    size_t unanswered = 0;
+    for (size_t i = 0; i < _targetCount; ++i) {
+      const TargetStats& stats = _targetStats[i];
+      total.requests += stats.requests;
+      total.responses += stats.responses;
+      total.retries += stats.retries;
+      total.timeouts += stats.timeouts;
+      total.notSent += stats.notSent;
+      unanswered += stats.recentUnansweredCount;
+    }
+    collector.addValue("pending", toolbox::format(F("%u/%u"), pendingCount(), PENDING_CAPACITY));
+    // requests: <requests> <responses>/<timeouts>/<not sent> (<retries>)
+    collector.addValue("requests", toolbox::format(F("%u %u/%u/%u (%u)"), total.requests, total.responses, total.timeouts, total.notSent, total.retries));
+    collector.addValue("rtt", toolbox::format(F("%u/%u/%u ms"), _rtt.percentileMs(50), _rtt.percentileMs(90), _rtt.maxMs()));
+    collector.addValue("coalesced", toolbox::convert<uint32_t>::toString(_coalescedRequests, 10));
+    // devices: <tracked> (<untracked due to full registry>)
+    collector.addValue("devices", toolbox::format(F("%u (%u)"), _otherDevices.size(), _otherDevices.overflows()));
+    // unanswered: recently timed out IDs of all targets (at most 4 per target)
+    collector.addValue("unanswered", toolbox::convert<size_t>::toString(unanswered, 10));
+    for (auto& listener : _listeners) {
+      // <listener>: <invocations> <total time> us
+      collector.addValue(listener.name, toolbox::format(F("%u %u us"), listener.invocations, listener.timeUs));
+    }
   }
 
   bool ready() const {
@@ -202,11 +401,44 @@ public:
     return _devices;
   }
 
-  const std::set<DeviceId>& getOtherDeviceIds() const {
-    return _otherDeviceIds;
+  const DeviceRegistry& getOtherDevices() const {
+    return _otherDevices;
+  }
+
+  /**
+   * Declare the source devices of which the given owner (a component name)
+   * needs to receive messages. The CAN interface may drop messages of all other
+   * sources as early as possible. A source with wildcards accepts any messages.
+   */
+  void setAcceptedSources(const char* owner, std::vector<DeviceId> sources) {
+    std::sort(sources.begin(), sources.end());
+    sources.erase(std::unique(sources.begin(), sources.end()), sources.end());
+    auto& acceptedSources = _acceptedSources[owner];
+    if (acceptedSources == sources) {
+      return;
+    }
+    acceptedSources = std::move(sources);
+    updateAcceptedIds();
+  }
+
+  size_t getTargetCount() const {
+    return _targetCount;
   }
 
-  OperationResult request(RequestData const& data) {
+  const TargetStats& getTargetStats(size_t index) const {
+    return _targetStats[index];
+  }
+
+  /**
+   * Request a value from the target device. The request is tracked until the
+   * target responds or it times out (after the retries given by the policy);
+   * a retry which cannot be sent within the timeout is given up as not sent.
+   * The optional completion handler is called with the outcome in any case.
+   * If the same value is already being requested, no additional frame is sent
+   * and the handler is called with the outcome of the pending request (whose
+   * traffic class and policy stay in effect).
+   */
+  OperationResult request(RequestData const& data, TrafficClass trafficClass = TrafficClass::Poll, RequestCompletionHandler completionHandler = nullptr, RequestPolicy policy = {}) {
     if (!_ready) {
       return OperationResult::NotReady;
     }
@@ -216,24 +448,45 @@ public:
       return OperationResult::Invalid;
     }
 
-    _system.lyield();
+    PendingRequest* pending = findPending(data.targetId, data.valueId);
+    if (pending != nullptr && isRetryExpired(*pending, millis())) {
+      giveUpRetry(*pending); // do not let a request which cannot be sent swallow new ones
+      pending = nullptr;
+    }
+    if (pending != nullptr) {
+      // The same value is already being requested: wait for its response instead of sending another frame
+      if (completionHandler) {
+        pending->completionHandlers.push_back(std::move(completionHandler));
+      }
+      _coalescedRequests += 1;
+      return OperationResult::Accepted;
+    }
 
-    CanMessage message;
+    pending = allocatePending();
+    if (pending == nullptr) {
+      return OperationResult::QueueFull;
+    }
 
-    message.id = toCanId(data.sourceId);
-    message.ext = false;
-    message.rtr = false;
-    message.len = 7;
-    setTargetId(data.targetId, message.data);
-    setMessageType(MessageType::Request, message.data);
-    setValueId(data.valueId, message.data);
-    message.data[5] = 0x00u;
-    message.data[6] = 0x00u;
+    pending->trafficClass = trafficClass;
+    pending->retriesLeft = policy.retries;
+    pending->sourceId = data.sourceId;
+    pending->targetId = data.targetId;
+    pending->valueId = data.valueId;
+    pending->timeoutMs = policy.timeoutMs;
+    if (completionHandler) {
+      pending->completionHandlers.push_back(std::move(completionHandler));
+    }
 
-    return _can.sendCanMessage(message);
+    OperationResult result = sendRequest(*pending);
+    if (result == OperationResult::Accepted) {
+      targetStats(data.targetId).requests += 1;
+    } else {
+      freePending(*pending);
+    }
+    return result;
   }
 
-  OperationResult write(WriteData const& data) {
+  OperationResult write(WriteData const& data, TxCompletionHandler completionHandler = nullptr) {
     if (!_ready) {
       return OperationResult::NotReady;
     }
@@ -256,7 +509,7 @@ public:
     setValueId(data.valueId, message.data);
     setValue(data.value, message.data);
     
-    return _can.sendCanMessage(message);
+    return _can.sendCanMessage(message, TrafficClass::Write, completionHandler);
   }
 
   OperationResult respond(ResponseData const& data) {
@@ -282,34 +535,22 @@ public:
     setValueId(data.valueId, message.data);
     setValue(data.value, message.data);
     
-    return _can.sendCanMessage(message);
-  }
-
-  void onResponse(std::function<void(ResponseData const& data)> responseHandler) {
-    if (_responseListener) {
-      auto previousHandler = _responseListener;
-      _responseListener = [=](ResponseData const& data) { previousHandler(data); responseHandler(data); };
-    } else {
-      _responseListener = responseHandler;
-    }
+    return _can.sendCanMessage(message, TrafficClass::Registration); // responses are only sent by our own devices
   }
 
-  void onWrite(std::function<void(WriteData const& data)> writeHandler) {
-    if (_writeListener) {
-      auto previousHandler = _writeListener;
-      _writeListener = [=](WriteData const& data) { previousHandler(data); writeHandler(data); };
-    } else {
-      _writeListener = writeHandler;
-    }
+  /**
+   * Register a listener, which is called for all messages matching its interest.
+   * The returned ID can be used to change the interest later on.
+   */
+  ListenerId addListener(const char* name, MessageInterest interest, MessageHandler handler) {
+    _listeners.push_back({name, std::move(interest), handler, 0u, 0u});
+    rebuildListenerIndex();
+    return _listeners.size() - 1;
   }
 
-  void onRequest(std::function<void(RequestData const& data)> requestHandler) {
-    if (_requestListener) {
-      auto previousHandler = _requestListener;
-      _requestListener = [=](RequestData const& data) { previousHandler(data); requestHandler(data); };
-    } else {
-      _requestListener = requestHandler;
-    }
+  void setInterest(ListenerId listener, MessageInterest interest) {
+    _listeners[listener].interest = std::move(interest);
+    rebuildListenerIndex();
   }
 
 private:
@@ -336,7 +577,254 @@ private:
     message.data[5] = 0x00u; // TODO unclear what these values mean (they seem to be constant)
     message.data[6] = 0x00u; // TODO unclear what these values mean (they seem to be constant)
     
-    _can.sendCanMessage(message);
+    _can.sendCanMessage(message, TrafficClass::Registration);
+  }
+
+  TargetStats& targetStats(DeviceId const& target) {
+    for (size_t i = 0; i < _targetCount; ++i) {
+      if (_targetStats[i].target == target) {
+        return _targetStats[i];
+      }
+    }
+    if (_targetCount < TARGET_CAPACITY - 1) {
+      _targetStats[_targetCount].target = target;
+      return _targetStats[_targetCount++];
+    }
+    TargetStats& others = _targetStats[TARGET_CAPACITY - 1];
+    if (_targetCount < TARGET_CAPACITY) {
+      others.target = DeviceId(); // any
+      _targetCount += 1;
+    }
+    return others;
+  }
+
+  size_t pendingCount() const {
+    size_t count = 0;
+    for (auto& pending : _pending) {
+      if (pending.state != PendingState::Free) {
+        count += 1;
+      }
+    }
+    return count;
+  }
+
+  PendingRequest* findPending(DeviceId const& targetId, ValueId valueId) {
+    for (auto& pending : _pending) {
+      if (pending.state != PendingState::Free && pending.valueId == valueId && pending.targetId == targetId) {
+        return &pending;
+      }
+    }
+    return nullptr;
+  }
+
+  PendingRequest* allocatePending() {
+    for (auto& pending : _pending) {
+      if (pending.state == PendingState::Free) {
+        pending.ticket = ++_nextTicket;
+        pending.state = PendingState::Queued;
+        return &pending;
+      }
+    }
+    return nullptr;
+  }
+
+  void freePending(PendingRequest& pending) {
+    pending.state = PendingState::Free;
+    pending.completionHandlers.clear();
+  }
+
+  OperationResult sendRequest(PendingRequest& pending) {
+    _system.lyield();
+
+    CanMessage message;
+
+    message.id = toCanId(pending.sourceId);
+    message.ext = false;
+    message.rtr = false;
+    message.len = 7;
+    setTargetId(pending.targetId, message.data);
+    setMessageType(MessageType::Request, message.data);
+    setValueId(pending.valueId, message.data);
+    message.data[5] = 0x00u;
+    message.data[6] = 0x00u;
+
+    size_t index = &pending - _pending;
+    uint16_t ticket = pending.ticket;
+    OperationResult result = _can.sendCanMessage(message, pending.trafficClass, [this, index, ticket] (bool sent) { processRequestSent(index, ticket, sent); });
+    if (result == OperationResult::Accepted && pending.state == PendingState::Retry) {
+      pending.state = PendingState::Queued;
+    }
+    return result;
+  }
+
+  void processRequestSent(size_t index, uint16_t ticket, bool sent) {
+    PendingRequest& pending = _pending[index];
+    if (pending.state != PendingState::Queued || pending.ticket != ticket) {
+      return; // already completed (e.g. by a response to someone else's request)
+    }
+
+    if (sent) {
+      pending.state = PendingState::Sent;
+      pending.sentMs = millis();
+    } else if (pending.retriesLeft > 0) {
+      retryPending(pending, millis());
+    } else {
+      targetStats(pending.targetId).notSent += 1;
+      completePending(pending, RequestOutcome::NotSent, nullptr);
+    }
+  }
+
+  void retryPending(PendingRequest& pending, unsigned long currentMs) {
+    pending.retriesLeft -= 1;
+    pending.state = PendingState::Retry;
+    pending.retryMs = currentMs;
+    targetStats(pending.targetId).retries += 1;
+  }
+
+  bool isRetryExpired(PendingRequest const& pending, unsigned long currentMs) const {
+    return pending.state == PendingState::Retry && static_cast<long>(currentMs - pending.retryMs) >= static_cast<long>(pending.timeoutMs);
+  }
+
+  void giveUpRetry(PendingRequest& pending) {
+    targetStats(pending.targetId).notSent += 1;
+    _logger.log(iot_core::LogLevel::Debug, toolbox::format(F("Request for %04X from %s could not be sent again."), pending.valueId, pending.targetId.toString()));
+    completePending(pending, RequestOutcome::NotSent, nullptr);
+  }
+
+  void maintainPendingRequests() {
+    unsigned long currentMs = millis();
+    for (auto& pending : _pending) {
+      if (pending.state == PendingState::Sent && currentMs - pending.sentMs >= pending.timeoutMs) {
+        if (pending.retriesLeft > 0) {
+          retryPending(pending, currentMs);
+        } else {
+          TargetStats& stats = targetStats(pending.targetId);
+          stats.timeouts += 1;
+          stats.addUnanswered(pending.valueId);
+          _logger.log(iot_core::LogLevel::Debug, toolbox::format(F("Request for %04X from %s timed out."), pending.valueId, pending.targetId.toString()));
+          completePending(pending, RequestOutcome::TimedOut, nullptr);
+        }
+      }
+
+      if (isRetryExpired(pending, currentMs)) {
+        giveUpRetry(pending);
+      } else if (pending.state == PendingState::Retry) {
+        OperationResult result = sendRequest(pending);
+        if (result == OperationResult::NotReady || result == OperationResult::Invalid) {
+          giveUpRetry(pending); // the CAN interface will not take it any time soon
+        }
+        // if it is only rate limited or the queue is full, try again later
+      }
+    }
+  }
+
+  void processPendingResponse(ResponseData const& data) {
+    PendingRequest* pending = findPending(data.sourceId, data.valueId);
+    if (pending == nullptr) {
+      return;
+    }
+
+    TargetStats& stats = targetStats(data.sourceId);
+    stats.responses += 1;
+    stats.removeUnanswered(data.valueId);
+    if (pending->state == PendingState::Sent) {
+      unsigned long receivedMs = data.timestampMs != 0 ? data.timestampMs : millis();
+      uint32_t rttMs = static_cast<long>(receivedMs - pending->sentMs) > 0 ? receivedMs - pending->sentMs : 0;
+      stats.rttSumMs += rttMs;
+      stats.rttMaxMs = std::max(stats.rttMaxMs, rttMs);
+      _rtt.add(rttMs);
+    }
+
+    completePending(*pending, RequestOutcome::Responded, &data);
+  }
+
+  void completePending(PendingRequest& pending, RequestOutcome outcome, ResponseData const* response) {
+    // The handlers may issue new requests reusing the slot, so they are taken out of it first
+    std::vector<RequestCompletionHandler> completionHandlers;
+    completionHandlers.swap(pending.completionHandlers);
+    freePending(pending);
+    for (auto& completionHandler : completionHandlers) {
+      completionHandler(outcome, response);
+    }
+    if (pending.completionHandlers.empty()) {
+      // hand the storage back to the slot, so that it does not have to be allocated again
+      completionHandlers.clear();
+      pending.completionHandlers.swap(completionHandlers);
+    }
+  }
+
+  static int dispatchIndex(MessageType type) {
+    switch (type) {
+      case MessageType::Write: return 0;
+      case MessageType::Request: return 1;
+      case MessageType::Response: return 2;
+      default: return -1;
+    }
+  }
+
+  void rebuildListenerIndex() {
+    static constexpr MessageType DISPATCHED_TYPES[DISPATCHED_MESSAGE_TYPES] = { MessageType::Write, MessageType::Request, MessageType::Response };
+    for (size_t i = 0; i < DISPATCHED_MESSAGE_TYPES; ++i) {
+      ListenerIndex& index = _listenerIndex[i];
+      index.byValueId.clear();
+      index.others.clear();
+      for (ListenerId listener = 0; listener < _listeners.size(); ++listener) {
+        const MessageInterest& interest = _listeners[listener].interest;
+        if ((interest.messageTypes & MessageInterest::typeBit(DISPATCHED_TYPES[i])) == 0) {
+          continue;
+        }
+        if (interest.valueIds.empty()) {
+          index.others.push_back(listener);
+        } else {
+          for (ValueId valueId : interest.valueIds) {
+            index.byValueId.emplace_back(valueId, listener);
+          }
+        }
+      }
+      std::sort(index.byValueId.begin(), index.byValueId.end());
+    }
+  }
+
+  void dispatch(ProtocolMessage const& message) {
+    int i = dispatchIndex(message.type);
+    if (i < 0) {
+      return;
+    }
+
+    const ListenerIndex& index = _listenerIndex[i];
+    auto byValueId = std::equal_range(index.byValueId.begin(), index.byValueId.end(), std::make_pair(message.valueId, ListenerId(0)),
+      [] (std::pair<ValueId, ListenerId> const& a, std::pair<ValueId, ListenerId> const& b) { return a.first < b.first; });
+    for (auto it = byValueId.first; it != byValueId.second; ++it) {
+      invoke(it->second, message);
+    }
+    for (ListenerId listener : index.others) {
+      invoke(listener, message);
+    }
+  }
+
+  void invoke(ListenerId id, ProtocolMessage const& message) {
+    MessageListener& listener = _listeners[id];
+    if (!listener.interest.matches(message.sourceId, message.valueId)) {
+      return;
+    }
+    uint32_t startUs = micros();
+    listener.handler(message);
+    listener.timeUs += micros() - startUs;
+    listener.invocations += 1;
+  }
+
+  void updateAcceptedIds() {
+    std::vector<uint32_t> ids {};
+    for (auto& [owner, sources] : _acceptedSources) {
+      for (auto& source : sources) {
+        if (!source.isExact()) {
+          _can.setAcceptedIds({});
+          return;
+        }
+        ids.push_back(toCanId(source));
+      }
+    }
+    _can.setAcceptedIds(ids);
   }
 
   void processProtocol(CanMessage const& frame) {
@@ -357,66 +845,75 @@ private:
         target.address = DEVICE_ADDR_ANY;
       }
 
-      logMessage(frame, type, target, source, valueId, value);
+      logMessage(frame, type, target, source);
 
       bool handled = false;
 
       switch (type)
       {
       case MessageType::Write:
-        {
-          WriteData data {source, target, valueId, value};
-          handled = forwardMessage(target, data, &IStiebelEltronDevice::write);
-          if (_writeListener) {
-            _writeListener(data);
-          }
-        }
+        handled = forwardMessage(target, WriteData{source, target, valueId, value, frame.timestampMs}, &IStiebelEltronDevice::write);
         break;
       case MessageType::Response:
-        {
-          ResponseData data {source, target, valueId, value};
-          handled = forwardMessage(target, data, &IStiebelEltronDevice::receive);
-          if (_responseListener) {
-            _responseListener({ source, target, valueId, value });
-          }
-        }
+        handled = forwardMessage(target, ResponseData{source, target, valueId, value, frame.timestampMs}, &IStiebelEltronDevice::receive);
         break;
       case MessageType::Request:
-        {
-          RequestData data {source, target, valueId};
-          handled = forwardMessage(target, data, &IStiebelEltronDevice::request);
-          if (_requestListener) {
-            _requestListener({ source, target, valueId });
-          }
-        }
+        handled = forwardMessage(target, RequestData{source, target, valueId, frame.timestampMs}, &IStiebelEltronDevice::request);
+        value = 0u;
+        break;
+      default:
         break;
       }
 
-      if (source.isExact()) {
-        _otherDeviceIds.insert(source);
+      dispatch({type, source, target, valueId, value, frame.timestampMs});
+
+      if (type == MessageType::Response) {
+        processPendingResponse({source, target, valueId, value, frame.timestampMs});
       }
 
-      if (!handled && target.isExact()) {
-        _otherDeviceIds.insert(target);
+      trackDevices(type, source, handled ? DeviceId() : target, valueId, frame.timestampMs != 0 ? frame.timestampMs : millis());
+    }
+  }
+
+  /**
+   * Update the statistics of the sending device and, unless it is one of our
+   * own devices, of the target device.
+   */
+  void trackDevices(MessageType type, DeviceId source, DeviceId target, ValueId valueId, unsigned long timestampMs) {
+    DeviceStats* sourceStats = _otherDevices.obtain(source);
+    if (sourceStats != nullptr) {
+      sourceStats->lastSeenMs = timestampMs;
+      switch (type) {
+        case MessageType::Write: sourceStats->writes += 1; break;
+        case MessageType::Request: sourceStats->requests += 1; break;
+        case MessageType::Response: sourceStats->responses += 1; break;
+        default: sourceStats->others += 1; break;
+      }
+      if (type == MessageType::Response && sourceStats->pendingMs != 0 && sourceStats->pendingValueId == valueId) {
+        uint32_t latencyMs = timestampMs - sourceStats->pendingMs;
+        sourceStats->answered += 1;
+        sourceStats->latencySumMs += latencyMs;
+        sourceStats->latencyMaxMs = std::max(sourceStats->latencyMaxMs, latencyMs);
+        sourceStats->pendingMs = 0;
       }
     }
+
+    DeviceStats* targetStats = _otherDevices.obtain(target);
+    if (targetStats != nullptr && type == MessageType::Request) {
+      targetStats->requested += 1;
+      targetStats->pendingValueId = valueId;
+      targetStats->pendingMs = timestampMs;
+    }
   }
 
-  void logMessage(CanMessage const& frame, MessageType type, DeviceId target, DeviceId source, ValueId valueId, uint16_t value) {
+  void logMessage(CanMessage const& frame, MessageType type, DeviceId target, DeviceId source) {
     switch (type)
     {
-    case MessageType::Register:
-      _logger.log(iot_core::LogLevel::Debug, [&] () { return toolbox::format(F("%s t:%s s:%s %02X %02X %02X %02X %02X"), messageTypeToString(type), target.toString(0), source.toString(1), frame.data[2], frame.data[3], frame.data[4], frame.data[5], frame.data[6]); });
-      break;
     case MessageType::Write:
-      _logger.log(iot_core::LogLevel::Debug, [&] () { return toolbox::format(F("%s t:%s s:%s id:%04X%c v:%04X"), messageTypeToString(type), target.toString(0), source.toString(1), valueId, hasShortValueId(frame.data) ? 's' : 'l', value); });
-      break;
-    case MessageType::Response:
-      _logger.log(iot_core::LogLevel::Debug, [&] () { return toolbox::format(F("%s t:%s s:%s id:%04X%c v:%04X"), messageTypeToString(type), target.toString(0), source.toString(1), valueId, hasShortValueId(frame.data) ? 's' : 'l', value); });
-      break;
     case MessageType::Request:
-      _logger.log(iot_core::LogLevel::Debug, [&] () { return toolbox::format(F("%s t:%s s:%s id:%04X%c"), messageTypeToString(type), target.toString(0), source.toString(1), valueId, hasShortValueId(frame.data) ? 's' : 'l'); });
-      break;
+    case MessageType::Response:
+    case MessageType::Register:
+      return; // all frames are recorded in the CAN trace, only unexpected ones are logged
     default:
       _logger.log(iot_core::LogLevel::Info, [&] () { return toolbox::format(F("%s t:%s s:%s %02X %02X %02X %02X %02X"), messageTypeToString(type), target.toString(0), source.toString(1), frame.data[2], frame.data[3], frame.data[4], frame.data[5], frame.data[6]); });
       break;
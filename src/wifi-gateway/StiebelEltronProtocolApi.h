@@ -43,8 +43,29 @@ private:
     writer.close();
     writer.property(F("others"));
     writer.openList();
-    for (auto& deviceId : _protocol.getOtherDeviceIds()) {
-      writer.string(deviceId.toString());
+    for (auto& stats : _protocol.getOtherDevices()) {
+      writer.string(stats.id.toString());
+    }
+    writer.close();
+    writer.property(F("stats"));
+    writer.openObject();
+    unsigned long nowMs = millis();
+    for (auto& stats : _protocol.getOtherDevices()) {
+      writer.property(stats.id.toString()).openObject();
+      if (stats.lastSeenMs != 0) {
+        writer.property(F("lastSeenMsAgo")).number(nowMs - stats.lastSeenMs);
+      } else {
+        writer.property(F("lastSeenMsAgo")).null();
+      }
+      writer.property(F("writes")).number(stats.writes);
+      writer.property(F("requests")).number(stats.requests);
+      writer.property(F("responses")).number(stats.responses);
+      writer.property(F("others")).number(stats.others);
+      writer.property(F("requested")).number(stats.requested);
+      writer.property(F("answered")).number(stats.answered);
+      writer.property(F("avgLatencyMs")).number(stats.averageLatencyMs());
+      writer.property(F("maxLatencyMs")).number(stats.latencyMaxMs);
+      writer.close();
     }
     writer.close();
     writer.close();
@@ -140,16 +140,18 @@ struct WriteData {
   DeviceId targetId;
   ValueId valueId;
   uint16_t value;
+  unsigned long timestampMs; // millis() at which the message was received from the bus (0 if not received)
 
-  WriteData(DeviceId sourceId, DeviceId targetId, ValueId valueId, uint16_t value) : sourceId(sourceId), targetId(targetId), valueId(valueId), value(value) {}
+  WriteData(DeviceId sourceId, DeviceId targetId, ValueId valueId, uint16_t value, unsigned long timestampMs = 0) : sourceId(sourceId), targetId(targetId), valueId(valueId), value(value), timestampMs(timestampMs) {}
 };
 
 struct RequestData {
   DeviceId sourceId;
   DeviceId targetId;
   ValueId valueId;
+  unsigned long timestampMs; // millis() at which the message was received from the bus (0 if not received)
   
-  RequestData(DeviceId sourceId, DeviceId targetId, ValueId valueId) : sourceId(sourceId), targetId(targetId), valueId(valueId) {}
+  RequestData(DeviceId sourceId, DeviceId targetId, ValueId valueId, unsigned long timestampMs = 0) : sourceId(sourceId), targetId(targetId), valueId(valueId), timestampMs(timestampMs) {}
 };
 
 struct ResponseData {
@@ -157,12 +159,16 @@ struct ResponseData {
   DeviceId targetId;
   ValueId valueId;
   uint16_t value;
+  unsigned long timestampMs; // millis() at which the message was received from the bus (0 if not received)
 
-  ResponseData(DeviceId sourceId, DeviceId targetId, ValueId valueId, uint16_t value) : sourceId(sourceId), targetId(targetId), valueId(valueId), value(value) {}
+  ResponseData(DeviceId sourceId, DeviceId targetId, ValueId valueId, uint16_t value, unsigned long timestampMs = 0) : sourceId(sourceId), targetId(targetId), valueId(valueId), value(value), timestampMs(timestampMs) {}
 };
 
 const ValueId UNKNOWN_VALUE_ID = 0u;
 
+// Value sent by devices in responses for IDs they do not support (or which currently have no value).
+const uint16_t VALUE_NOT_AVAILABLE = 0x8000u;
+
 // "Special" single byte value IDs:
 const uint8_t VALUE_ID_EXTENDED = 0xFAu; // signals that a 16-bit value ID is used for transfer
 const uint8_t VALUE_ID_SYSTEM_RESET = 0xFBu;
@@ -0,0 +1,186 @@
+#ifndef TXRATELIMITER_H_
+#define TXRATELIMITER_H_
+
+#include <cstdint>
+#include <algorithm>
+#include "CanInterface.h"
+
+/**
+ * Budget of a single traffic class. All token amounts are in millitokens
+ * (1000 millitokens = 1 frame) to avoid floating point arithmetic.
+ */
+struct TrafficClassBudget {
+  uint8_t sharePercent; // share of the effective TX rate
+  uint8_t burst; // maximum number of frames which can be accumulated
+  uint32_t milliTokens;
+  uint32_t refillRemainder; // fraction of a millitoken (in 1/shareScale()) not yet added
+  uint32_t granted;
+  uint32_t borrowed; // frames which used tokens from the shared pool
+
+  uint32_t capacity() const { return burst * 1000u; }
+};
+
+/**
+ * Token bucket rate limiter with a separate budget per traffic class and a
+ * shared burst pool.
+ *
+ * Each class is refilled with its share of the effective TX rate. Tokens
+ * exceeding the burst capacity of a class, as well as the unassigned share
+ * of the rate, flow into the shared pool. A class which has used up its own
+ * budget can borrow from the shared pool. This way, idle classes leave their
+ * budget to busy ones, while no class can starve another one.
+ *
+ * Shares are set one at a time (e.g. when the configuration is restored), so
+ * their sum is not checked. If it exceeds 100%, all shares are scaled down
+ * proportionally when refilling.
+ */
+class TxRateLimiter final {
+public:
+  static constexpr unsigned long MAX_REFILL_INTERVAL_MS = 10000;
+
+private:
+  TrafficClassBudget _budgets[TRAFFIC_CLASS_COUNT];
+  uint8_t _sharedBurst;
+  uint32_t _sharedMilliTokens;
+  uint32_t _sharedRefillRemainder;
+  unsigned long _lastRefillMs;
+
+  /**
+   * Divisor turning share units into millitokens: 100, or the sum of all
+   * shares if it exceeds 100%.
+   */
+  uint32_t shareScale() const {
+    return std::max<uint16_t>(assignedSharePercent(), 100u);
+  }
+
+public:
+  TxRateLimiter() :
+    _budgets{
+      {20u, 3u}, // Write
+      {10u, 5u}, // TimeSync
+      {5u, 2u}, // Registration
+      {45u, 2u}, // Poll
+      {10u, 1u}, // Discovery
+    },
+    _sharedBurst(6u),
+    _sharedMilliTokens(0u),
+    _sharedRefillRemainder(0u),
+    _lastRefillMs(0u)
+  {
+    fill();
+  }
+
+  const TrafficClassBudget& budget(TrafficClass trafficClass) const {
+    return _budgets[static_cast<size_t>(trafficClass)];
+  }
+
+  uint8_t sharedBurst() const {
+    return _sharedBurst;
+  }
+
+  uint32_t sharedMilliTokens() const {
+    return _sharedMilliTokens;
+  }
+
+  uint16_t assignedSharePercent() const {
+    uint16_t assigned = 0u;
+    for (auto& budget : _budgets) {
+      assigned += budget.sharePercent;
+    }
+    return assigned;
+  }
+
+  uint8_t unassignedSharePercent() const {
+    uint16_t assigned = assignedSharePercent();
+    return assigned < 100u ? 100u - assigned : 0u;
+  }
+
+  bool setShare(TrafficClass trafficClass, uint8_t sharePercent) {
+    if (sharePercent > 100u) {
+      return false;
+    }
+    _budgets[static_cast<size_t>(trafficClass)].sharePercent = sharePercent;
+    return true;
+  }
+
+  bool setBurst(TrafficClass trafficClass, uint8_t burst) {
+    auto& budget = _budgets[static_cast<size_t>(trafficClass)];
+    budget.burst = burst;
+    budget.milliTokens = std::min(budget.milliTokens, budget.capacity());
+    return true;
+  }
+
+  bool setSharedBurst(uint8_t burst) {
+    _sharedBurst = burst;
+    _sharedMilliTokens = std::min(_sharedMilliTokens, _sharedBurst * 1000u);
+    return true;
+  }
+
+  /**
+   * Fill all budgets up to their burst capacity.
+   */
+  void fill() {
+    for (auto& budget : _budgets) {
+      budget.milliTokens = budget.capacity();
+      budget.refillRemainder = 0u;
+    }
+    _sharedMilliTokens = _sharedBurst * 1000u;
+    _sharedRefillRemainder = 0u;
+  }
+
+  /**
+   * Refill the budgets based on the time elapsed since the last refill and
+   * the effective TX rate (in frames/s = millitokens/ms).
+   */
+  void refill(unsigned long currentMs, uint8_t txRate) {
+    unsigned long elapsedMs = currentMs - _lastRefillMs;
+    if (elapsedMs == 0) {
+      return;
+    }
+    _lastRefillMs = currentMs;
+    elapsedMs = std::min(elapsedMs, MAX_REFILL_INTERVAL_MS);
+
+    uint32_t scale = shareScale();
+    uint32_t overflow = 0u;
+    for (auto& budget : _budgets) {
+      uint32_t units = elapsedMs * txRate * budget.sharePercent + budget.refillRemainder;
+      budget.milliTokens += units / scale;
+      budget.refillRemainder = units % scale;
+      if (budget.milliTokens > budget.capacity()) {
+        overflow += budget.milliTokens - budget.capacity();
+        budget.milliTokens = budget.capacity();
+      }
+    }
+
+    uint32_t units = elapsedMs * txRate * unassignedSharePercent() + _sharedRefillRemainder;
+    _sharedRefillRemainder = units % scale;
+    _sharedMilliTokens = std::min(_sharedMilliTokens + overflow + units / scale, _sharedBurst * 1000u);
+  }
+
+  bool available(TrafficClass trafficClass) const {
+    return budget(trafficClass).milliTokens >= 1000u || _sharedMilliTokens >= 1000u;
+  }
+
+  /**
+   * Number of whole frames the given class could send right now.
+   */
+  uint32_t availableFrames(TrafficClass trafficClass) const {
+    return (budget(trafficClass).milliTokens + _sharedMilliTokens) / 1000u;
+  }
+
+  bool consume(TrafficClass trafficClass) {
+    auto& budget = _budgets[static_cast<size_t>(trafficClass)];
+    if (budget.milliTokens >= 1000u) {
+      budget.milliTokens -= 1000u;
+    } else if (_sharedMilliTokens >= 1000u) {
+      _sharedMilliTokens -= 1000u;
+      budget.borrowed += 1u;
+    } else {
+      return false;
+    }
+    budget.granted += 1u;
+    return true;
+  }
+};
+
+#endif
@@ -46,6 +46,7 @@ public:
   virtual toolbox::Maybe<int32_t> fromJson(jsons::Value& input) const = 0;
   virtual const char* describe() const = 0;
   virtual const char* key() const = 0;
+  virtual uint8_t decimalPlaces() const { return 0; } // of the converted value relative to the decoded one
 };
 
 class ICustomConverter : public IConverter {
@@ -265,6 +266,9 @@ public:
   const char* key() const override {
     return KEY;
   }
+  uint8_t decimalPlaces() const override {
+    return _decimalPlaces;
+  }
 };
 template<uint8_t _decimalPlaces>
 const toolbox::str<5> NumericValueConverter<_decimalPlaces>::KEY { _decimalPlaces == 0 ? "int" : toolbox::format("10^%i", -_decimalPlaces)};
@@ -201,7 +201,50 @@ ValueAccessMode valueAccessModeFromString(const toolbox::strref& accessMode) {
   return ValueAccessMode::None;
 }
 
+/**
+ * When updates of a value are passed on to consumers (e.g. MQTT).
+ */
+enum struct NotifyPolicy : uint8_t {
+  /*
+   * Every received value is passed on.
+   */
+  Always = 0,
+  /*
+   * Only values which differ from the last one passed on.
+   */
+  Change = 1,
+  /*
+   * Only values which differ by more than the deadband (in the converted
+   * unit) from the last one passed on.
+   */
+  Deadband = 2,
+  /*
+   * Only values which differ by more than the deadband (in percent of
+   * the last one passed on).
+   */
+  RelativeDeadband = 3,
+};
+
+toolbox::strref notifyPolicyToString(NotifyPolicy policy) {
+  switch (policy) {
+    case NotifyPolicy::Always: return "Always";
+    case NotifyPolicy::Change: return "Change";
+    case NotifyPolicy::Deadband: return "Deadband";
+    case NotifyPolicy::RelativeDeadband: return "RelativeDeadband";
+    default: return "";
+  }
+}
+
+NotifyPolicy notifyPolicyFromString(const toolbox::strref& policy) {
+  if (policy == "Always") return NotifyPolicy::Always;
+  if (policy == "Change") return NotifyPolicy::Change;
+  if (policy == "Deadband") return NotifyPolicy::Deadband;
+  if (policy == "RelativeDeadband") return NotifyPolicy::RelativeDeadband;
+  return NotifyPolicy::Always;
+}
+
 static const size_t MAX_DEFINITION_NAME_LENGTH = 32u;
+static const uint8_t DEADBAND_DECIMAL_PLACES = 2u;
 
 struct __attribute__((__packed__)) ValueDefinition final {
   static const ValueDefinition UNDEFINED;
@@ -211,6 +254,9 @@ struct __attribute__((__packed__)) ValueDefinition final {
   uint8_t codec = NONE_CODEC_ID;
   uint8_t converter = NONE_CONVERTER_ID;
   uint32_t updateIntervalMs = 30000u;
+  NotifyPolicy notify = NotifyPolicy::Always;
+  uint16_t deadband = 0u; // in hundredths (see DEADBAND_DECIMAL_PLACES) of the converted unit or percent
+  uint16_t heartbeatS = 0u; // maximum time without passing on an update (0 = none)
   char name[MAX_DEFINITION_NAME_LENGTH] = {'\0'};
 
   ValueDefinition() {};
@@ -230,6 +276,9 @@ struct __attribute__((__packed__)) ValueDefinition final {
         && codec == other.codec
         && converter == other.converter
         && updateIntervalMs == other.updateIntervalMs
+        && notify == other.notify
+        && deadband == other.deadband
+        && heartbeatS == other.heartbeatS
         && strncmp(name, other.name, MAX_DEFINITION_NAME_LENGTH) == 0;
   }
 
@@ -243,6 +292,9 @@ struct __attribute__((__packed__)) ValueDefinition final {
     output.property(F("unit")).string(unitToString(unit));
     output.property(F("access")).string(valueAccessModeToString(accessMode));
     output.property(F("interval")).number(updateIntervalMs);
+    output.property(F("notify")).string(notifyPolicyToString(notify));
+    output.property(F("deadband")).number(toolbox::Decimal::fromFixedPoint(deadband, DEADBAND_DECIMAL_PLACES));
+    output.property(F("heartbeat")).number(heartbeatS);
     output.property(F("codec"));
     auto codecObject = repository.getCodec(codec);
     if (codecObject) {
@@ -272,6 +324,16 @@ struct __attribute__((__packed__)) ValueDefinition final {
           accessMode = valueAccessModeFromString(property.asString().get());
         } else if (property.name() == "interval" && property.type() == jsons::ValueType::Integer) {
           updateIntervalMs = property.asInteger().get();
+        } else if (property.name() == "notify" && property.type() == jsons::ValueType::String) {
+          notify = notifyPolicyFromString(property.asString().get());
+        } else if (property.name() == "deadband") {
+          auto decimal = property.asDecimal();
+          if (!decimal) {
+            return false;
+          }
+          deadband = std::min<int32_t>(std::max<int32_t>(decimal.get().toFixedPoint(DEADBAND_DECIMAL_PLACES), 0), UINT16_MAX);
+        } else if (property.name() == "heartbeat" && property.type() == jsons::ValueType::Integer) {
+          heartbeatS = std::min<int32_t>(std::max<int32_t>(property.asInteger().get(), 0), UINT16_MAX);
         } else if (property.name() == "codec") {
           if (property.type() == jsons::ValueType::Integer) {
             codec = property.asInteger().get();
@@ -15,6 +15,7 @@
 #include <iot_core/api/SystemApi.h>
 #include "AppVersion.h"
 #include "SerialCan.h"
+#include "CanTraceApi.h"
 #include "StiebelEltronProtocol.h"
 #include "StiebelEltronProtocolApi.h"
 #include "ValueConversion.h"
@@ -24,6 +25,11 @@
 #include "DateTimeSource.h"
 #include "DataAccess.h"
 #include "DataAccessApi.h"
+#include "DataHistory.h"
+#include "DataLog.h"
+#include "DataHistoryApi.h"
+#include "DiscoveryScanner.h"
+#include "DiscoveryScannerApi.h"
 #ifdef MQTT_SUPPORT
 #include "MqttClient.h"
 #endif
@@ -56,6 +62,7 @@ iot_core::api::Server api { sys };
 iot_core::api::SystemApi systemApi { sys, sys };
 
 SerialCan can { sys, io::canResetPin, io::txEnablePin };
+CanTraceApi traceApi { sys, can.trace() };
 StiebelEltronProtocol protocol { sys, can };
 StiebelEltronProtocolApi protocolApi { sys, protocol };
 ConversionRepository conversions { sys };
@@ -64,8 +71,13 @@ DefinitionRepository definitions { sys, conversions };
 DefinitionsApi definitionsApi { sys, conversions, definitions };
 ConversionService conversionService { conversions, definitions };
 DateTimeSource timeSource { sys.logger("dts"), protocol, conversionService };
-DataAccess access { sys, protocol, definitions, io::writeEnablePin };
+DataAccess access { sys, protocol, definitions, conversionService, io::writeEnablePin };
 DataAccessApi accessApi { sys, access, conversionService, definitions };
+DataHistory history { sys, access };
+DataLog dataLog { sys, access, conversionService, definitions };
+DataHistoryApi historyApi { sys, history, dataLog, access, conversionService };
+DiscoveryScanner discovery { sys, protocol, access };
+DiscoveryScannerApi discoveryApi { sys, discovery };
 #ifdef MQTT_SUPPORT
 MqttClient mqtt { sys, access, conversionService, definitions };
 #endif
@@ -88,15 +100,21 @@ void setup() {
   sys.addComponent(&definitions);
   sys.addComponent(&timeSource);
   sys.addComponent(&access);
+  sys.addComponent(&history);
+  sys.addComponent(&dataLog);
+  sys.addComponent(&discovery);
 #ifdef MQTT_SUPPORT
   sys.addComponent(&mqtt);
 #endif
 
   api.addProvider(&systemApi);
+  api.addProvider(&traceApi);
   api.addProvider(&protocolApi);
   api.addProvider(&conversionsApi);
   api.addProvider(&definitionsApi);
   api.addProvider(&accessApi);
+  api.addProvider(&historyApi);
+  api.addProvider(&discoveryApi);
   api.addProvider(&ui);
 
   sys.setup();